@@ -4,11 +4,31 @@
 #include <cmath> 
 #include <cstdio>
 #include "legion.h"
+#include "default_mapper.h"
 #include <vector>
 #include <queue>
 #include <utility>
+#include <map>
+#include <set>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cerrno>
+#include <deque>
+#include <list>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 using namespace Legion;
+using namespace Legion::Mapping;
 using namespace std;
 
 enum TASK_IDs
@@ -27,17 +47,63 @@ enum TASK_IDs
     INNER_PRODUCT_INTER_TASK_ID,
     INNER_PRODUCT_INTRA_TASK_ID,
     GAXPY_INTER_TASK_ID,
-    GAXPY_INTRA_TASK_ID
+    GAXPY_INTRA_TASK_ID,
+    TRUNCATE_INTER_TASK_ID,
+    TRUNCATE_UPDATE_TASK_ID,
+    INNER_PRODUCT_MIXED_INTER_TASK_ID,
+    INNER_PRODUCT_MIXED_INTRA_TASK_ID,
+    GAXPY_MIXED_INTER_TASK_ID,
+    GAXPY_MIXED_INTRA_TASK_ID,
+    HASH_REFINE_TASK_ID,
+    HASH_REFINE_INTRA_TASK_ID,
+    HASH_COMPRESS_TASK_ID,
+    HASH_COMPRESS_INTRA_TASK_ID,
+    HASH_RECONSTRUCT_TASK_ID,
+    HASH_RECONSTRUCT_INTRA_TASK_ID,
+    HASH_NORM_TASK_ID,
+    HASH_NORM_INTRA_TASK_ID,
+    HASH_INNER_PRODUCT_TASK_ID,
+    HASH_INNER_PRODUCT_INTRA_TASK_ID,
+    HASH_GAXPY_TASK_ID,
+    HASH_GAXPY_INTRA_TASK_ID,
+    HASH_PRINT_TASK_ID,
+    SERIAL_REFINE_TASK_ID,
+    SERIAL_COMPRESS_TASK_ID,
+    SERIAL_RECONSTRUCT_TASK_ID,
+    SERIAL_NORM_TASK_ID,
+    SERIAL_TRUNCATE_TASK_ID,
+    SERIAL_INNER_PRODUCT_TASK_ID,
+    SERIAL_GAXPY_TASK_ID,
+    SERIAL_INNER_PRODUCT_MIXED_TASK_ID,
+    SERIAL_GAXPY_MIXED_TASK_ID,
+    DIFFERENTIATE_INTER_TASK_ID,
+    DIFFERENTIATE_INTRA_TASK_ID,
+    APPLY_INTER_TASK_ID,
+    APPLY_INTRA_TASK_ID,
+    INNER_PRODUCT_SCREENED_INTER_TASK_ID,
+    INNER_PRODUCT_SCREENED_INTRA_TASK_ID,
+    PREFETCH_TILE_TASK_ID,
+    PARTITION_INTER_TASK_ID,
+    HASH_TILE_TASK_ID,
+    SAME_TREE_TASK_ID,
+    ACCUMULATE_INTER_TASK_ID,
+    ACCUMULATE_INTRA_TASK_ID,
+    SERVICE_WAKE_TASK_ID
 };
 
 enum FieldId{
     FID_X,
+    FID_Y,
+};
+
+enum ReductionId{
+    TREE_SUM_REDOP_ID = 1,
 };
 
 struct Arguments {
     int n;
     int l;
-    int actual_l;
+    coord_t actual_l;
     int max_depth;
     coord_t idx;
     coord_t end_idx;
@@ -47,8 +113,18 @@ struct Arguments {
     int tile_height;
     int root_location;
     int carry;
-    Arguments(int _n, int _l, int _actual_l , int _max_depth, coord_t _idx, coord_t _end_idx, Color _partition_color, int _actual_max_depth=0, int _tile_height=1, int _root_location=1, int _carry =0 )
-        : n(_n), l(_l), actual_l(_actual_l), max_depth(_max_depth), idx(_idx), end_idx(_end_idx), partition_color(_partition_color), actual_max_depth(_actual_max_depth), tile_height(_tile_height), root_location(_root_location),carry(_carry)
+    int tolerance;
+    coord_t serial_cutoff;
+    bool serial;
+    bool prefetch;
+    int function;
+    double refine_tolerance;
+    int pair_function;
+    long int pair_gen;
+    int source_tile_height;
+    bool memoize;
+    Arguments(int _n, int _l, coord_t _actual_l , int _max_depth, coord_t _idx, coord_t _end_idx, Color _partition_color, int _actual_max_depth=0, int _tile_height=1, int _root_location=1, int _carry =0 )
+        : n(_n), l(_l), actual_l(_actual_l), max_depth(_max_depth), idx(_idx), end_idx(_end_idx), gen(0), partition_color(_partition_color), actual_max_depth(_actual_max_depth), tile_height(_tile_height), root_location(_root_location),carry(_carry), tolerance(0), serial_cutoff(0), serial(false), prefetch(false), function(0), refine_tolerance(0), pair_function(-1), pair_gen(0), source_tile_height(0), memoize(false)
     {
         if (_actual_max_depth == 0) {
             actual_max_depth = _max_depth;
@@ -66,8 +142,11 @@ struct InnerProductArgs{
     Color partition_color1, partition_color2;
     int actual_max_depth;
     int tile_height;
+    coord_t serial_cutoff;
+    bool serial;
+    bool prefetch;
     InnerProductArgs(int _n, int _l, int _max_depth, coord_t _idx, coord_t _end_idx, Color _partition_color1, Color _partition_color2, int _actual_max_depth=0, int _tile_height=1 )
-        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), end_idx(_end_idx) ,partition_color1(_partition_color1), partition_color2(_partition_color2), actual_max_depth(_actual_max_depth), tile_height(_tile_height)
+        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), end_idx(_end_idx) ,partition_color1(_partition_color1), partition_color2(_partition_color2), actual_max_depth(_actual_max_depth), tile_height(_tile_height), serial_cutoff(0), serial(false), prefetch(false)
     {
         if (_actual_max_depth == 0) {
             actual_max_depth = _max_depth;
@@ -78,7 +157,7 @@ struct InnerProductArgs{
 struct GaxpyArgs{
     int n;
     int l;
-    int actual_l;
+    coord_t actual_l;
     int max_depth;
     coord_t idx;
     coord_t end_idx;
@@ -88,8 +167,10 @@ struct GaxpyArgs{
     int actual_max_depth;
     int tile_height;
     bool left_null, right_null;
-    GaxpyArgs(int _n, int _l, int _actual_l, int _max_depth, coord_t _idx, coord_t _end_idx, Color _partition_color1, Color _partition_color2, Color _partition_color3, int _pass, bool _left_null, bool _right_null, int _actual_max_depth=0, int _tile_height=1 )
-        : n(_n), l(_l), actual_l(_actual_l) , max_depth(_max_depth), idx(_idx), end_idx(_end_idx),partition_color1(_partition_color1), partition_color2(_partition_color2), partition_color3(_partition_color3) ,pass(_pass), left_null(_left_null), right_null(_right_null), actual_max_depth(_actual_max_depth), tile_height(_tile_height)
+    coord_t serial_cutoff;
+    bool serial;
+    GaxpyArgs(int _n, int _l, coord_t _actual_l, int _max_depth, coord_t _idx, coord_t _end_idx, Color _partition_color1, Color _partition_color2, Color _partition_color3, int _pass, bool _left_null, bool _right_null, int _actual_max_depth=0, int _tile_height=1 )
+        : n(_n), l(_l), actual_l(_actual_l) , max_depth(_max_depth), idx(_idx), end_idx(_end_idx),partition_color1(_partition_color1), partition_color2(_partition_color2), partition_color3(_partition_color3) ,pass(_pass), left_null(_left_null), right_null(_right_null), actual_max_depth(_actual_max_depth), tile_height(_tile_height), serial_cutoff(0), serial(false)
     {
         if (_actual_max_depth == 0) {
             actual_max_depth = _max_depth;
@@ -97,391 +178,2952 @@ struct GaxpyArgs{
     }
 };
 
+// norm is the sum of squares of every value in the node's subtree as of the
+// last compress, or -1 once an operation has changed the subtree since. hash
+// identifies the subtree's contents (see node_hash), or is 0 while stale.
+// height is the number of levels below the node in its subtree; hash_subtree
+// writes it with the hash, so it is only meaningful while the hash is.
 struct TreeArgs{
     int value;
-    int lval;
+    coord_t lval;
     bool is_leaf;
-    TreeArgs( int _value, int _lval , bool _is_leaf=false ) : value(_value), lval(_lval), is_leaf(_is_leaf) {}
+    int norm;
+    unsigned long long hash;
+    int height;
+    TreeArgs( int _value, coord_t _lval , bool _is_leaf=false ) : value(_value), lval(_lval), is_leaf(_is_leaf), norm(-1), hash(0), height(-1) {}
+};
+
+// Sums trees node by node for accumulate. A node is internal in the sum when
+// it is internal in any producer, so a producer that refines further than the
+// others adds structure. Only value and is_leaf are reduced, each with one
+// atomic operation when shared: the fill with identity leaves norm and hash
+// stale, and the reconstruct that follows every accumulate writes lval.
+struct TreeSumReduction{
+    typedef TreeArgs LHS;
+    typedef TreeArgs RHS;
+    static const TreeArgs identity;
+    template<bool EXCLUSIVE> static void apply( LHS &lhs, RHS rhs );
+    template<bool EXCLUSIVE> static void fold( RHS &rhs1, RHS rhs2 );
 };
 
+const TreeArgs TreeSumReduction::identity = TreeArgs(0, 0, true);
+
+template<>
+void TreeSumReduction::apply<true>( LHS &lhs, RHS rhs ){
+    lhs.value += rhs.value;
+    lhs.is_leaf = lhs.is_leaf && rhs.is_leaf;
+}
+
+template<>
+void TreeSumReduction::apply<false>( LHS &lhs, RHS rhs ){
+    __sync_fetch_and_add(&lhs.value, rhs.value);
+    if( !rhs.is_leaf )
+        __atomic_store_n(&lhs.is_leaf, false, __ATOMIC_RELAXED);
+}
+
+template<>
+void TreeSumReduction::fold<true>( RHS &rhs1, RHS rhs2 ){
+    TreeSumReduction::apply<true>(rhs1, rhs2);
+}
+
+template<>
+void TreeSumReduction::fold<false>( RHS &rhs1, RHS rhs2 ){
+    TreeSumReduction::apply<false>(rhs1, rhs2);
+}
+
+int subtree_norm( int value, int left_norm, int right_norm ){
+    if( left_norm < 0 || right_norm < 0 )
+        return -1;
+    return value*value + left_norm + right_norm;
+}
+
+// Bound on the part of the product strictly below a node that is internal in
+// both trees, or -1 when either subtree norm is stale.
+double descendant_bound( const TreeArgs &node1, const TreeArgs &node2 ){
+    if( node1.norm < 0 || node2.norm < 0 )
+        return -1;
+    double rest1 = node1.norm - node1.value*node1.value;
+    double rest2 = node2.norm - node2.value*node2.value;
+    return sqrt(rest1*rest2);
+}
+
 struct GaxpyHelper{
     int n,l;
     coord_t idx;
     int pass;
     bool left_null, right_null;
     bool launch;
-    int actual_l;
-    GaxpyHelper( int _n, int _l, coord_t _idx, int _pass, bool _left_null, bool _right_null , bool _launch, int _actual_l ) : n(_n), l(_l), idx(_idx), pass(_pass), left_null(_left_null), right_null(_right_null), launch(_launch), actual_l(_actual_l)    {}
+    coord_t actual_l;
+    GaxpyHelper( int _n, int _l, coord_t _idx, int _pass, bool _left_null, bool _right_null , bool _launch, coord_t _actual_l ) : n(_n), l(_l), idx(_idx), pass(_pass), left_null(_left_null), right_null(_right_null), launch(_launch), actual_l(_actual_l)    {}
 };
 
 struct HelperArgs{
     int level;
-    int actual_l;
+    coord_t actual_l;
     coord_t idx;
     bool launch;
     int n;
     bool is_valid_entry;
     int carry;
-    HelperArgs( int _level, int _actual_l ,coord_t _idx, bool _launch, int _n , bool _is_valid_entry=false, int _carry = 0 ) : level(_level), actual_l(_actual_l) ,idx(_idx), launch(_launch), n(_n), is_valid_entry( _is_valid_entry ), carry(_carry) {}
+    int height;
+    HelperArgs( int _level, coord_t _actual_l ,coord_t _idx, bool _launch, int _n , bool _is_valid_entry=false, int _carry = 0, int _height = -1 ) : level(_level), actual_l(_actual_l) ,idx(_idx), launch(_launch), n(_n), is_valid_entry( _is_valid_entry ), carry(_carry), height(_height) {}
 };
 
 struct RootPosArgs{
     int value;
-    RootPosArgs( int _value =1 ): value(_value) {}
+    int norm;
+    unsigned long long hash;
+    RootPosArgs( int _value =1, int _norm =-1, unsigned long long _hash =0 ): value(_value), norm(_norm), hash(_hash) {}
  };
 
+struct TileHashArgs{
+    coord_t idx;
+    int n;
+    int max_depth;
+    int tile_height;
+    int width;
+    TileHashArgs( coord_t _idx, int _n, int _max_depth, int _tile_height, int _width=0 ) : idx(_idx), n(_n), max_depth(_max_depth), tile_height(_tile_height), width(_width) {}
+};
 
+// reshaped is set by a tile whose collapses removed some of its child
+// launches, so the partitions below it no longer match the tree.
+struct TruncateResult{
+    int norm;
+    int sum;
+    bool collapsible;
+    bool reshaped;
+    TruncateResult( int _norm=0, int _sum=0, bool _collapsible=true ) : norm(_norm), sum(_sum), collapsible(_collapsible), reshaped(false) {}
+};
 
-void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime) {
+bool truncate_collapses( const TruncateResult &left, const TruncateResult &right, int tolerance ){
+    return left.collapsible && right.collapsible && ( left.norm + right.norm <= tolerance*tolerance );
+}
 
-    int overall_max_depth = 7;
-    int actual_left_depth = 0;
-    int tile_height = 3;
+#define MAX_SERIAL_BATCH 16
 
-    long int seed = 12345;
-    {
-        const InputArgs &command_args = HighLevelRuntime::get_input_args();
-        for (int idx = 1; idx < command_args.argc; ++idx)
-        {
-            if (strcmp(command_args.argv[idx], "-max_depth") == 0)
-                overall_max_depth = atoi(command_args.argv[++idx]);
-            else if (strcmp(command_args.argv[idx], "-seed") == 0)
-                seed = atol(command_args.argv[++idx]);
-            else if(strcmp(command_args.argv[idx],"--tile") == 0)
-                tile_height = atoi( command_args.argv[++idx]);
-        }
+struct TruncateBatchResult{
+    int count;
+    TruncateResult member[MAX_SERIAL_BATCH];
+    TruncateBatchResult() : count(0) {}
+};
+
+struct CompressBatchResult{
+    int count;
+    RootPosArgs member[MAX_SERIAL_BATCH];
+    CompressBatchResult() : count(0) {}
+};
+
+coord_t child_tile_start( coord_t tile_start, int tile_height, int max_depth, int n, int l, int child ){
+    coord_t sub_tree_size = (1LL<<(max_depth-n-1))-1;
+    return tile_start + (1LL<<tile_height)-1 + (2*l+child)*sub_tree_size;
+}
+
+int batch_width( int max_depth, int child_n, coord_t serial_cutoff ){
+    if( serial_cutoff <= 0 )
+        return 0;
+    coord_t estimate = (1LL<<(max_depth-child_n))-1;
+    if( estimate > serial_cutoff )
+        return 0;
+    return (int) max(1LL, min((long long) MAX_SERIAL_BATCH, (long long) (serial_cutoff/estimate)));
+}
+
+int batch_count( int children, int width ){
+    return width == 0 ? children : (children+width-1)/width;
+}
+
+// Batched subtrees get no tile partitions below the batch, so a walk has to
+// batch at the cutoff the tree was partitioned with. Whatever builds the
+// partitions stores that cutoff on the tree's index space, and the root task
+// of every walk reads it back rather than trusting its caller's.
+const SemanticTag SERIAL_CUTOFF_TAG = 1;
+
+void store_serial_cutoff( HighLevelRuntime *runtime, IndexSpace is, coord_t serial_cutoff ){
+    runtime->attach_semantic_information(is, SERIAL_CUTOFF_TAG, &serial_cutoff, sizeof(coord_t), true);
+}
+
+coord_t stored_serial_cutoff( HighLevelRuntime *runtime, const Task *task ){
+    const void *result;
+    size_t size;
+    if( !runtime->retrieve_semantic_information(task->regions[0].parent.get_index_space(), SERIAL_CUTOFF_TAG, result, size, true, true) )
+        return 0;
+    return *(const coord_t *) result;
+}
+
+// DefaultMapper reads the low bits of a mapping tag as flags
+// (SAME_ADDRESS_SPACE and the like), so the priority sits above them and
+// leaves them clear.
+#define PRIORITY_TAG_SHIFT 16
+
+// Set on an index launch whose points carry priorities of their own, each at
+// the end of its point's argument (see batch_argument_map).
+#define POINT_PRIORITY_TAG (1<<(PRIORITY_TAG_SHIFT-1))
+
+// Mapping tag for the tasks working on a subtree rooted at level n: the
+// levels it can still have below it. SubtreeMapper runs higher priorities
+// first, so the deep subtrees that set an operation's finishing time start
+// ahead of the one-tile work launched beside them.
+MappingTagID subtree_priority( int max_depth, int n ){
+    return (MappingTagID) max(max_depth-n, 0) << PRIORITY_TAG_SHIFT;
+}
+
+TaskPriority tag_priority( MappingTagID tag ){
+    return (TaskPriority)(tag >> PRIORITY_TAG_SHIFT);
+}
+
+// Priority of a child subtree rooted at level n under a node whose height
+// is known: the levels the subtree really has, on subtree_priority's scale.
+// A height of -1 (stale) leaves subtree_priority's bound.
+TaskPriority child_priority( int max_depth, int n, int height ){
+    int bound = max(max_depth-n, 0);
+    return (TaskPriority)(height > 0 ? min(height, bound) : bound);
+}
+
+TaskPriority task_priority( const Task &task ){
+    if( task.is_index_space && (task.tag & POINT_PRIORITY_TAG) && task.local_arglen >= sizeof(TaskPriority) ){
+        TaskPriority priority;
+        memcpy(&priority, (const char *) task.local_args + task.local_arglen - sizeof(TaskPriority), sizeof(TaskPriority));
+        return priority;
     }
-    srand(time(NULL));
-    Rect<1> tree_rect(0LL, static_cast<coord_t>(pow(2, overall_max_depth)));
-    IndexSpace is = runtime->create_index_space(ctx, tree_rect);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
+    return tag_priority(task.tag);
+}
+
+DomainPointColoring batch_coloring( const vector<pair<coord_t,coord_t> > &ranges, int width ){
+    DomainPointColoring coloring;
+    for( int i = 0 ; i < batch_count(ranges.size(), width) ; i++ ){
+        int first = width == 0 ? i : i*width;
+        int last = width == 0 ? i : min((int) ranges.size(), (i+1)*width)-1;
+        coloring[i] = Rect<1>(ranges[first].first, ranges[last].second);
     }
-    LogicalRegion lr1 = runtime->create_logical_region(ctx, is, fs);
-    Color partition_color1 = 10;
-    coord_t end_idx = (1<<overall_max_depth)-1;
-    Arguments args1(0, 0, 0, overall_max_depth, 0, end_idx, partition_color1, actual_left_depth, tile_height);
-    args1.gen = rand();
-    cout<<"Launching Refine Task"<<endl;
-    TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    refine_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1));
-    refine_launcher.add_field(0, FID_X);
-    runtime->execute_task(ctx, refine_launcher);
+    return coloring;
+}
 
-    cout<<"Launching Print Task After Refine"<<endl;
-    TaskLauncher print_launcher(PRINT_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    RegionRequirement req3( lr1 , READ_ONLY, EXCLUSIVE, lr1 );
-    req3.add_field(FID_X);
-    print_launcher.add_region_requirement( req3 );
-    runtime->execute_task(ctx, print_launcher);
-
-    // cout<<"Launching Compress Task"<<endl;
-    // Rect<1> root_location(0, 1);
-    // is = runtime->create_index_space(ctx, root_location);
-    // fs = runtime->create_field_space(ctx);
-    // {
-    //     FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-    //     allocator.allocate_field(sizeof(RootPosArgs), FID_X);
-    // }
-    // LogicalRegion root_locate_region = runtime->create_logical_region(ctx, is, fs);
-    // args1.root_location=-1;
-    // TaskLauncher compress_launcher(COMPRESS_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    // compress_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1));
-    // compress_launcher.add_region_requirement(RegionRequirement(root_locate_region,WRITE_DISCARD,EXCLUSIVE,root_locate_region));
-    // compress_launcher.add_field(0,FID_X);
-    // compress_launcher.add_field(1,FID_X);
-    // runtime->execute_task(ctx, compress_launcher);
-
-    // cout<<"Launching Print After Compress"<<endl;
-    // runtime->execute_task(ctx,print_launcher);
-    // cout<<"Launching Reconstruct Task"<<endl;
-    // args1.carry=0;
-    // TaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, TaskArgument(&args1,sizeof(Arguments)));
-    // reconstruct_launcher.add_region_requirement(RegionRequirement(lr1,WRITE_DISCARD,EXCLUSIVE,lr1));
-    // reconstruct_launcher.add_field(0,FID_X);
-    // runtime->execute_task(ctx, reconstruct_launcher);
-
-    // cout<<"Launching Print After Reconstruct"<<endl;
-    // runtime->execute_task(ctx,print_launcher);
-
-    // cout<<"Launching Norm Task"<<endl;
-    // TaskLauncher norm_launcher(NORM_INTER_TASK_ID, TaskArgument(&args1,sizeof(Arguments)));
-    // norm_launcher.add_region_requirement(RegionRequirement(lr1,WRITE_DISCARD,EXCLUSIVE,lr1));
-    // norm_launcher.add_field(0,FID_X);
-    // Future f = runtime->execute_task(ctx,norm_launcher);
-    // cout<<sqrt(f.get_result<int>())<<endl;
-
-    cout<<"Creating 2nd Logical Region "<<overall_max_depth<<endl;
-    Rect<1> tree_second(0LL, static_cast<coord_t>(pow(2, overall_max_depth)));
-    IndexSpace is2 = runtime->create_index_space(ctx, tree_second);
-    FieldSpace fs2 = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs2);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
+// With priorities, one per child, each point's argument ends with the
+// highest priority among its children, for a launch tagged
+// POINT_PRIORITY_TAG; the tasks never read past their arguments.
+template<typename T>
+void batch_argument_map( ArgumentMap &arg_map, const vector<T> &child_args, int width, vector<vector<char> > &buffers, const vector<TaskPriority> *priorities=NULL ){
+    int points = batch_count(child_args.size(), width);
+    buffers.resize(points);
+    for( int i = 0 ; i < points ; i++ ){
+        if( width == 0 && priorities == NULL ){
+            arg_map.set_point(i, TaskArgument(&child_args[i], sizeof(T)));
+            continue;
+        }
+        int first = width == 0 ? i : i*width;
+        int count = width == 0 ? 1 : min((int) child_args.size(), (i+1)*width)-first;
+        size_t header = width == 0 ? 0 : sizeof(int);
+        buffers[i].resize(header+count*sizeof(T));
+        memcpy(&buffers[i][0], &count, header);
+        memcpy(&buffers[i][header], &child_args[first], count*sizeof(T));
+        if( priorities != NULL ){
+            TaskPriority priority = *max_element(priorities->begin()+first, priorities->begin()+first+count);
+            buffers[i].resize(buffers[i].size()+sizeof(TaskPriority));
+            memcpy(&buffers[i][buffers[i].size()-sizeof(TaskPriority)], &priority, sizeof(TaskPriority));
+        }
+        arg_map.set_point(i, TaskArgument(&buffers[i][0], buffers[i].size()));
     }
-    LogicalRegion lr2 = runtime->create_logical_region(ctx, is2, fs2);
-    Color partition_color2 = 20;
-    Arguments args2(0, 0, 0,overall_max_depth, 0, end_idx, partition_color2, actual_left_depth, tile_height);
-    args2.gen=rand();
-    //cout<<"Launching Refine Task For 2nd  Tree"<<endl;
-    TaskLauncher refine_launcher2(REFINE_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    refine_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2));
-    refine_launcher2.add_field(0, FID_X);
-    runtime->execute_task(ctx, refine_launcher2);
+}
 
-    //cout<<"Print Task for 2nd Tree"<<endl;
-    TaskLauncher print_launcher2(PRINT_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    RegionRequirement req4( lr2 , READ_ONLY, EXCLUSIVE, lr2 );
-    req4.add_field(FID_X);
-    print_launcher2.add_region_requirement( req4 );
-    runtime->execute_task(ctx, print_launcher2);
-    
-    // cout<<"Launching Compress Task for 2nd Tree"<<endl;
-    // TaskLauncher compress_launcher2(COMPRESS_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    // compress_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2));
-    // compress_launcher2.add_region_requirement(RegionRequirement(root_locate_region,WRITE_DISCARD,EXCLUSIVE,root_locate_region));
-    // compress_launcher2.add_field(0, FID_X);
-    // compress_launcher2.add_field(1,FID_X);
-    // runtime->execute_task(ctx, compress_launcher2);
-    // cout<<"Launching Print After Compress for 2nd Tree"<<endl;
-    // runtime->execute_task(ctx, print_launcher2);
+template<typename T>
+vector<T> unpack_batch( const Task *task ){
+    const char *buffer = task->is_index_space ? (const char *) task->local_args : (const char *) task->args;
+    int count = *(const int *) buffer;
+    const T *members = (const T *)(buffer+sizeof(int));
+    vector<T> batch(members, members+count);
+    for( int i = 0 ; i < count ; i++ )
+        batch[i].serial = true;
+    return batch;
+}
 
-    cout<<"Launching Inner Product Task"<<endl;
-    InnerProductArgs args(0, 0, overall_max_depth, 0, end_idx, partition_color1, partition_color2, actual_left_depth, tile_height);
-    TaskLauncher product_launcher(INNER_PRODUCT_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
-    product_launcher.add_region_requirement(RegionRequirement(lr1, READ_ONLY, EXCLUSIVE, lr1));
-    product_launcher.add_region_requirement(RegionRequirement(lr2, READ_ONLY, EXCLUSIVE, lr2) );
-    product_launcher.add_field(0,FID_X);
-    product_launcher.add_field(1,FID_X);
-    Future result = runtime->execute_task( ctx, product_launcher );
-    cout<<result.get_result<int>()<<endl;
+template<typename T>
+void write_launch_entries( const PhysicalRegion &region, const vector<T> &launch_entries ){
+    const FieldAccessor<WRITE_DISCARD,T,1,coord_t,Realm::AffineAccessor<T,1,coord_t> > helper_acc(region, FID_X);
+    for( size_t i = 0 ; i < launch_entries.size() ; i++ )
+        helper_acc[i] = launch_entries[i];
+    helper_acc[launch_entries.size()].launch = false;
+}
 
-    // Rect<1> gaxpy_tree(0LL, static_cast<coord_t>(pow(2, overall_max_depth )));
-    // IndexSpace isgaxpy = runtime->create_index_space(ctx, gaxpy_tree);
-    // FieldSpace fsgaxpy = runtime->create_field_space(ctx);
-    // {
-    //     FieldAllocator allocator = runtime->create_field_allocator(ctx, fsgaxpy);
-    //     allocator.allocate_field(sizeof(TreeArgs), FID_X);
-    // }
-    // LogicalRegion lrgaxpy = runtime->create_logical_region(ctx, isgaxpy, fsgaxpy);
-    // Color partition_color3 = 30;
-    // GaxpyArgs args(0, 0, 0, overall_max_depth, 0, end_idx, partition_color1, partition_color2, partition_color3, 0, false, false, actual_left_depth, tile_height);
-    
+// Process-wide count of the runtime objects the inter tasks create for their
+// own use, so a run can report how far each operation drove them up.
+static atomic<long long> live_objects(0), live_bytes(0), peak_objects(0), peak_bytes(0);
 
-    // cout<<"Launching Gaxpy Taks for Tree"<<endl;
-    // TaskLauncher gaxpy_launcher(GAXPY_INTER_TASK_ID, TaskArgument(&args, sizeof(GaxpyArgs)));
-    // RegionRequirement req1(lr1, READ_ONLY, EXCLUSIVE, lr1);
-    // req1.add_field(FID_X);
-    // RegionRequirement req2(lr2, READ_ONLY, EXCLUSIVE , lr2);
-    // req2.add_field(FID_X);
-    // RegionRequirement reqgaxpy(lrgaxpy, WRITE_DISCARD, EXCLUSIVE, lrgaxpy);
-    // reqgaxpy.add_field(FID_X);
-    // gaxpy_launcher.add_region_requirement(req1);
-    // gaxpy_launcher.add_region_requirement(req2);
-    // gaxpy_launcher.add_region_requirement(reqgaxpy);
-    // runtime->execute_task(ctx, gaxpy_launcher);
+void raise_peak( atomic<long long> &peak, long long value ){
+    long long seen = peak.load();
+    while( value > seen && !peak.compare_exchange_weak(seen, value) );
+}
 
-    // cout<<"Launching Print Task for Gaxpy"<<endl;
-    // TaskLauncher print_gaxpy(PRINT_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    // RegionRequirement gaxpy_req( lrgaxpy , READ_ONLY, EXCLUSIVE, lrgaxpy );
-    // gaxpy_req.add_field(FID_X);
-    // print_gaxpy.add_region_requirement( gaxpy_req );
-    // runtime->execute_task(ctx, print_gaxpy );
+void note_resources( long long objects, long long bytes ){
+    raise_peak(peak_objects, live_objects += objects);
+    raise_peak(peak_bytes, live_bytes += bytes);
 }
 
+void report_resources( const string &label ){
+    cout<<label<<": peak live objects "<<peak_objects.load()<<", peak instance bytes "<<peak_bytes.load()
+        <<", still live "<<live_objects.load()<<" objects / "<<live_bytes.load()<<" bytes"<<endl;
+    peak_objects = live_objects.load();
+    peak_bytes = live_bytes.load();
+}
 
-void print_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctxt, HighLevelRuntime *runtime) {
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], FID_X);
-    int node_counter=0;
-    int max_depth = args.max_depth;
-    queue<Arguments>tree;
-    tree.push(args);
-    int tile_height = args.tile_height;
-    while( !tree.empty() ){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx + l - 1 + (1<<(n%tile_height));
-        node_counter++;
-        cout<<node_counter<<": "<<n<<"~"<<read_acc[idx].lval<<"~"<<idx<<"~"<<read_acc[idx].value<<endl;
-        if(!read_acc[idx].is_leaf){
-            if((n%tile_height)==(tile_height-1)){
-                int tile_nodes = (1<<tile_height)-1;
-                coord_t sub_tree_size = (1<<(args.max_depth-n-1))-1;
-                coord_t start_idx = temp.idx+tile_nodes;
-                coord_t left_level = 2*l;
-                coord_t right_level = left_level+1;
-                coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
-                coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
-                Arguments for_left_sub_tree (n+1, 0, 0, max_depth, idx_left_sub_tree, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
-                Arguments for_right_sub_tree(n+1, 0, 0, max_depth, idx_right_sub_tree, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
-            }
-            else{
-                Arguments for_left_sub_tree (n+1, l * 2    , 0, max_depth, temp.idx, temp.idx, temp.partition_color, temp.actual_max_depth, temp.tile_height);
-                Arguments for_right_sub_tree(n+1, l * 2 + 1, 0, max_depth, temp.idx, temp.idx ,temp.partition_color, temp.actual_max_depth, temp.tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
-            }
-        }
-    }
+double wall_seconds(){
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void refine_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    queue<Arguments>tree;
-    tree.push(args);
-    LogicalRegion lr = regions[0].get_logical_region();
-    LogicalPartition lp = LogicalPartition::NO_PART;
-    LogicalRegion my_sub_tree_lr = lr;
-    int max_depth = args.max_depth;
-    int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
-    coord_t start_idx = args.idx;
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        int actual_l = temp.actual_l;
-        coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
-        long int node_value=rand();
-        node_value = node_value % 10 + 1;
-        if (node_value <= 3 || n == max_depth - 1) {
-            tree_acc[idx].value = node_value % 3 + 1;
-            tree_acc[idx].is_leaf =true;
-            tree_acc[idx].lval = actual_l;
+static double last_report_time = 0;
+
+// Prints the wall time since the previous report. The Legion and reference
+// drivers share it so their per-operation lines can be compared directly.
+void report_wall_time( const string &label ){
+    double now = wall_seconds();
+    cout<<label<<": "<<now-last_report_time<<" s wall"<<endl;
+    last_report_time = now;
+}
+
+// Owns the helper regions, scratch partitions and color spaces an inter task
+// creates. They are destroyed when the task body returns; the runtime defers
+// the actual reclamation until the child launches that use them have
+// finished, and keeps a color space alive while a partition still uses it.
+class ScratchResources{
+public:
+    ScratchResources( Context _ctx, HighLevelRuntime *_runtime ) : ctx(_ctx), runtime(_runtime), bytes(0) {}
+    ~ScratchResources(){
+        for( size_t i = 0 ; i < acquired.size() ; i++ ){
+            ReleaseLauncher release_launcher(acquired[i].region, acquired[i].parent);
+            release_launcher.add_field(acquired[i].field);
+            runtime->issue_release(ctx, release_launcher);
         }
-        else {
-            tree_acc[idx].value = 0;
-            tree_acc[idx].lval = actual_l;
+        for( int i = partitions.size()-1 ; i >= 0 ; i-- )
+            runtime->destroy_index_partition(ctx, partitions[i]);
+        for( int i = spaces.size()-1 ; i >= 0 ; i-- )
+            runtime->destroy_index_space(ctx, spaces[i]);
+        for( int i = regions.size()-1 ; i >= 0 ; i-- ){
+            runtime->destroy_logical_region(ctx, regions[i]);
+            runtime->destroy_field_space(ctx, regions[i].get_field_space());
+            runtime->destroy_index_space(ctx, regions[i].get_index_space());
         }
-        if( (node_value > 3 )&&( n +1 < max_depth ) ){
-            if( (n % tile_height )==( tile_height-1 ) ){
-                helper_acc[helper_counter].level = l;
-                helper_acc[helper_counter].idx = idx;
-                helper_acc[helper_counter].n = n;
-                helper_acc[helper_counter].launch = true;
-                helper_acc[helper_counter].actual_l = actual_l;
-                helper_counter++;
-            }
-            else{
-                Arguments for_left_sub_tree (n+1, l * 2    ,2*actual_l, max_depth, temp.idx, 0,temp.partition_color, temp.actual_max_depth, tile_height);
-                Arguments for_right_sub_tree(n+1, l * 2 + 1, 2*actual_l+1 ,max_depth, temp.idx, 0, temp.partition_color, temp.actual_max_depth, tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
-            }
+        note_resources(-(long long)(3*regions.size()+partitions.size()+spaces.size()), -bytes);
+    }
+    template<typename T>
+    LogicalRegion create_region( const Rect<1> &bounds ){
+        IndexSpace is = runtime->create_index_space(ctx, bounds);
+        FieldSpace fs = runtime->create_field_space(ctx);
+        {
+            FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+            allocator.allocate_field(sizeof(T), FID_X);
         }
+        LogicalRegion lr = runtime->create_logical_region(ctx, is, fs);
+        long long size = (long long) bounds.volume()*sizeof(T);
+        regions.push_back(lr);
+        bytes += size;
+        note_resources(3, size);
+        return lr;
+    }
+    IndexPartition adopt( IndexPartition ip ){
+        partitions.push_back(ip);
+        note_resources(1, 0);
+        return ip;
+    }
+    IndexSpace adopt( IndexSpace is ){
+        spaces.push_back(is);
+        note_resources(1, 0);
+        return is;
+    }
+    // Acquires field of a tile of a spilled tree; it is released when the
+    // task body returns, after the launches that read it.
+    void keep_acquired( LogicalRegion region, LogicalRegion parent, FieldID field ){
+        AcquireLauncher acquire_launcher(region, parent);
+        acquire_launcher.add_field(field);
+        runtime->issue_acquire(ctx, acquire_launcher);
+        AcquiredTile tile = { region, parent, field };
+        acquired.push_back(tile);
+    }
+private:
+    struct AcquiredTile{
+        LogicalRegion region;
+        LogicalRegion parent;
+        FieldID field;
+    };
+    Context ctx;
+    HighLevelRuntime *runtime;
+    vector<LogicalRegion> regions;
+    vector<IndexPartition> partitions;
+    vector<IndexSpace> spaces;
+    vector<AcquiredTile> acquired;
+    long long bytes;
+};
+
+// The subtree ranges of a tile's children in launch order, two per launch
+// entry, for the inter task's image partition. Unused slots are left empty.
+void write_child_ranges( const PhysicalRegion &region, const Arguments &args, const vector<HelperArgs> &launch_entries ){
+    const FieldAccessor<WRITE_DISCARD,Rect<1>,1,coord_t,Realm::AffineAccessor<Rect<1>,1,coord_t> > range_acc(region, FID_X);
+    int tile_height = min(args.tile_height, args.max_depth-args.n);
+    coord_t sub_tree_size = (1LL<<(args.max_depth-args.n-tile_height))-1;
+    coord_t start_idx = args.idx+(1<<tile_height)-1;
+    for( int i = 0 ; i < (1<<tile_height) ; i++ )
+        range_acc[i] = Rect<1>(0, -1);
+    for( size_t i = 0 ; i < launch_entries.size() ; i++ ){
+        coord_t idx_left_sub_tree = start_idx+2*launch_entries[i].level*sub_tree_size;
+        range_acc[2*i] = Rect<1>(idx_left_sub_tree, idx_left_sub_tree+sub_tree_size-1);
+        range_acc[2*i+1] = Rect<1>(idx_left_sub_tree+sub_tree_size, idx_left_sub_tree+2*sub_tree_size-1);
     }
 }
 
-void compress_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    queue<Arguments>tree;
-    tree.push(args);
-    int max_depth = args.max_depth;
-    int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], FID_X);
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > write_acc(regions[1], FID_X);
-    coord_t start_idx = args.idx;
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        int actual_l = temp.actual_l;
-        coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
-        if(read_acc[idx].is_leaf)
+LogicalRegion create_child_ranges( ScratchResources &scratch, int tile_height ){
+    return scratch.create_region<Rect<1> >(Rect<1>(0, (1<<tile_height)-1));
+}
+
+// Child partition of a tile by dependent partitioning: launch point i owns
+// the image of range entries [i*width, (i+1)*width), one entry when
+// unbatched, so a batch is the union of its children's subtrees. The runtime
+// computes it from the ranges the intra task wrote, as a deferred operation,
+// rather than from a coloring the inter task builds on the host.
+IndexPartition image_child_partition( Context ctx, HighLevelRuntime *runtime, ScratchResources &scratch, LogicalRegion childtree, LogicalRegion ranges, int points, int width, Color color ){
+    coord_t per_point = max(width, 1);
+    IndexSpace color_space = scratch.adopt(runtime->create_index_space(ctx, Rect<1>(0, points-1)));
+    Transform<1,1> transform;
+    transform[0][0] = per_point;
+    IndexPartition batches = scratch.adopt(runtime->create_partition_by_restriction(ctx, ranges.get_index_space(), color_space, transform, Rect<1>(0, per_point-1), DISJOINT_KIND));
+    LogicalPartition batch_ranges = runtime->get_logical_partition(ctx, ranges, batches);
+    return runtime->create_partition_by_image_range(ctx, childtree.get_index_space(), batch_ranges, ranges, FID_X, color_space, DISJOINT_KIND, color);
+}
+
+// A tree is one field of its region, and trees refined together share a
+// region (and so its tile partitions) as FID_X and FID_Y. Tasks take the field
+// from their requirement instead of assuming FID_X, and pass the same fields
+// on to the requirements they launch.
+FieldID tree_field( const Task *task, int idx, int which=0 ){
+    set<FieldID>::const_iterator it = task->regions[idx].privilege_fields.begin();
+    while( which-- > 0 )
+        ++it;
+    return *it;
+}
+
+void add_tree_fields( RegionRequirement &req, const Task *task, int idx, bool instance=true ){
+    const set<FieldID> &fields = task->regions[idx].privilege_fields;
+    for( set<FieldID>::const_iterator it = fields.begin() ; it != fields.end() ; ++it )
+        req.add_field(*it, instance);
+}
+
+// Inline-maps a helper region that an intra task filled, for reading. Mapping
+// the intra task's own WRITE_DISCARD requirement instead would let the runtime
+// hand back an instance without the entries.
+PhysicalRegion map_helper( Context ctx, HighLevelRuntime *runtime, LogicalRegion helper ){
+    RegionRequirement req(helper, READ_ONLY, EXCLUSIVE, helper);
+    req.add_field(FID_X);
+    return runtime->map_region(ctx, req);
+}
+
+// Out-of-core mode attaches a tree's file restricted, so a task that maps one
+// of its tiles would map the file itself. Launches that map tree fields go
+// through execute_resident, which acquires those tiles first (letting the
+// mapper copy them into memory) and releases them afterwards (writing them
+// back and letting the copy be collected). Trees not in spilled_tree_ids
+// launch as they are.
+static set<RegionTreeID> spilled_tree_ids;
+static mutex spilled_tree_lock;
+
+bool is_spilled( LogicalRegion lr ){
+    lock_guard<mutex> guard(spilled_tree_lock);
+    return spilled_tree_ids.count(lr.get_tree_id()) > 0;
+}
+
+// The acquired region of each requirement that maps a spilled tree; regions
+// left NO_REGION need nothing.
+vector<LogicalRegion> resident_regions( Context ctx, HighLevelRuntime *runtime, const vector<RegionRequirement> &reqs ){
+    vector<LogicalRegion> result(reqs.size(), LogicalRegion::NO_REGION);
+    for( size_t r = 0 ; r < reqs.size() ; r++ ){
+        if( reqs[r].instance_fields.empty() || !is_spilled(reqs[r].parent) )
             continue;
-        write_acc[helper_counter].actual_l = actual_l;
-        write_acc[helper_counter].level = l;
-        write_acc[helper_counter].idx = idx;
-        write_acc[helper_counter].n = n;
-        write_acc[helper_counter].is_valid_entry = true;
-        write_acc[helper_counter].launch=false;
-        if( ((n % tile_height ) ==( tile_height-1 )) ){
-            write_acc[helper_counter].launch = true;
-        }
-        else if( !read_acc[idx].is_leaf ){
-                Arguments for_left_sub_tree (n + 1, l*2   , 2*actual_l, max_depth, temp.idx,0, temp.partition_color, temp.actual_max_depth, tile_height);
-                Arguments for_right_sub_tree(n + 1, l * 2 + 1, 2*actual_l+1, max_depth, temp.idx,0, temp.partition_color, temp.actual_max_depth, tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
-        }
-        helper_counter++;
+        if( reqs[r].handle_type == PART_PROJECTION )
+            result[r] = runtime->get_parent_logical_region(ctx, reqs[r].partition);
+        else
+            result[r] = reqs[r].region;
     }
+    return result;
 }
 
-void compress_update_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > write_acc(regions[0], FID_X);
-    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(regions[1], FID_X);
-    const FieldAccessor<READ_ONLY,RootPosArgs,1,coord_t,Realm::AffineAccessor<RootPosArgs,1,coord_t> > read_child(regions[2], FID_X);
-    const FieldAccessor<WRITE_DISCARD,RootPosArgs,1,coord_t,Realm::AffineAccessor<RootPosArgs,1,coord_t> > write_value(regions[3], FID_X);
-    int task_counter = args.actual_max_depth;
-    int tile_height = args.tile_height;
-    for( int i = (1<<tile_height)-1; i>=0 ; i-- ){
-        if( !read_acc[i].is_valid_entry )
+void acquire_regions( Context ctx, HighLevelRuntime *runtime, const vector<RegionRequirement> &reqs, const vector<LogicalRegion> &resident ){
+    for( size_t r = 0 ; r < reqs.size() ; r++ ){
+        if( resident[r] == LogicalRegion::NO_REGION )
             continue;
-        coord_t idx = read_acc[i].idx;
-        if( write_acc[idx].is_leaf )
-           continue;
-        int nx = read_acc[i].n;
-        int l = read_acc[i].level;
-        int left_level = 2*l;
-        int right_level = 2*l+1;
-        coord_t idx_left_sub_tree,idx_right_sub_tree;
-        if((nx%tile_height)==(tile_height-1)){
-                int rightChildVal = read_child[task_counter--].value;
-                int leftChildVal = read_child[task_counter--].value;
-                write_acc[idx].value = leftChildVal + rightChildVal;
-        }
-        else{
-                idx_left_sub_tree = args.idx + left_level + (1<<((nx+1)%tile_height))-1;
-                idx_right_sub_tree = args.idx + right_level + (1<<((nx+1)%tile_height))-1;
-                write_acc[idx].value = write_acc[idx_left_sub_tree].value + write_acc[idx_right_sub_tree].value;
-        }
+        AcquireLauncher acquire_launcher(resident[r], reqs[r].parent);
+        for( size_t f = 0 ; f < reqs[r].instance_fields.size() ; f++ )
+            acquire_launcher.add_field(reqs[r].instance_fields[f]);
+        runtime->issue_acquire(ctx, acquire_launcher);
     }
-    write_value[args.root_location].value = write_acc[args.idx].value;
 }
 
+void release_regions( Context ctx, HighLevelRuntime *runtime, const vector<RegionRequirement> &reqs, const vector<LogicalRegion> &resident ){
+    for( size_t r = 0 ; r < reqs.size() ; r++ ){
+        if( resident[r] == LogicalRegion::NO_REGION )
+            continue;
+        ReleaseLauncher release_launcher(resident[r], reqs[r].parent);
+        for( size_t f = 0 ; f < reqs[r].instance_fields.size() ; f++ )
+            release_launcher.add_field(reqs[r].instance_fields[f]);
+        runtime->issue_release(ctx, release_launcher);
+    }
+}
 
+// acquire is false when the calling inter task's parent already acquired the
+// tile (see prefetch_child_tiles).
+Future execute_resident( Context ctx, HighLevelRuntime *runtime, const TaskLauncher &launcher, bool acquire=true ){
+    if( !acquire )
+        return runtime->execute_task(ctx, launcher);
+    vector<LogicalRegion> resident = resident_regions(ctx, runtime, launcher.region_requirements);
+    acquire_regions(ctx, runtime, launcher.region_requirements, resident);
+    Future result = runtime->execute_task(ctx, launcher);
+    release_regions(ctx, runtime, launcher.region_requirements, resident);
+    return result;
+}
 
+FutureMap execute_resident( Context ctx, HighLevelRuntime *runtime, const IndexTaskLauncher &launcher ){
+    vector<LogicalRegion> resident = resident_regions(ctx, runtime, launcher.region_requirements);
+    acquire_regions(ctx, runtime, launcher.region_requirements, resident);
+    FutureMap result = runtime->execute_index_space(ctx, launcher);
+    release_regions(ctx, runtime, launcher.region_requirements, resident);
+    return result;
+}
 
-void reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
+// Acquires the root tile of every child subtree a tile can have and maps it
+// while the tile itself is still being processed, so the recursion into a
+// spilled tree finds its next tiles already copied into memory. The tiles stay
+// acquired until the calling inter task returns, and the child inter tasks
+// launch their intra tasks without acquiring them again. A child that turns
+// out to be absent costs one wasted read.
+void prefetch_child_tiles( Context ctx, HighLevelRuntime *runtime, ScratchResources &scratch, LogicalRegion childtree, LogicalRegion parent, FieldID field, coord_t start_idx, coord_t sub_tree_size, int tile_height, int child_tile_height ){
+    int children = 1<<tile_height;
+    coord_t child_tile_nodes = (1LL<<child_tile_height)-1;
+    DomainPointColoring coloring;
+    for( int c = 0 ; c < children ; c++ )
+        coloring[c] = Rect<1>(start_idx+c*sub_tree_size, start_idx+c*sub_tree_size+child_tile_nodes-1);
+    Rect<1> color_space(0, children-1);
+    LogicalPartition lp = runtime->get_logical_partition(ctx, childtree, scratch.adopt(runtime->create_index_partition(ctx, childtree.get_index_space(), color_space, coloring, DISJOINT_KIND)));
+    for( int c = 0 ; c < children ; c++ )
+        scratch.keep_acquired(runtime->get_logical_subregion_by_color(ctx, lp, c), parent, field);
+    IndexTaskLauncher prefetch_launcher(PREFETCH_TILE_TASK_ID, color_space, TaskArgument(NULL, 0), ArgumentMap());
+    prefetch_launcher.add_region_requirement(RegionRequirement(lp, 0, READ_ONLY, EXCLUSIVE, parent));
+    prefetch_launcher.add_field(0, field);
+    runtime->execute_index_space(ctx, prefetch_launcher);
+}
+
+// With -resource_report, waits for everything issued so far and prints its
+// wall time, comparable with the reference driver's lines, and the resource
+// high-water mark reached since the previous report. Otherwise it returns at
+// once: the fence would serialize the script and service drivers.
+void report_operation( Context ctx, HighLevelRuntime *runtime, bool enabled, const string &label ){
+    if( !enabled )
+        return;
+    runtime->issue_execution_fence(ctx).get_void_result();
+    report_wall_time(label);
+    report_resources(label);
+}
+
+// base is where the tree's root sits in its region: 0 for a tree with a
+// region of its own, the tree's slot offset inside an ensemble.
+struct TreeLayout{
+    int max_depth;
+    int tile_height;
+    Color partition_color;
+    coord_t base;
+    TreeLayout( int _max_depth=0, int _tile_height=1, Color _partition_color=0, coord_t _base=0 ) : max_depth(_max_depth), tile_height(_tile_height), partition_color(_partition_color), base(_base) {}
+    bool operator==( const TreeLayout &other ) const { return max_depth == other.max_depth && tile_height == other.tile_height && base == other.base; }
+};
+
+struct MixedArgs{
+    int n;
+    int l;
+    coord_t actual_l;
+    coord_t idx;
+    coord_t end_idx;
+    TreeLayout layout1, layout2, layout3;
+    int pass;
+    bool left_null, right_null;
+    bool multiply;
+    coord_t serial_cutoff;
+    bool serial;
+    MixedArgs(int _n, int _l, coord_t _actual_l, coord_t _idx, coord_t _end_idx, TreeLayout _layout1, TreeLayout _layout2, TreeLayout _layout3=TreeLayout(), int _pass=0, bool _left_null=false, bool _right_null=false )
+        : n(_n), l(_l), actual_l(_actual_l), idx(_idx), end_idx(_end_idx), layout1(_layout1), layout2(_layout2), layout3(_layout3), pass(_pass), left_null(_left_null), right_null(_right_null), multiply(false), serial_cutoff(0), serial(false) {}
+};
+
+// Screened inner product: a pair of subtrees is skipped once the
+// Cauchy-Schwarz bound on the product below it drops under tolerance, and
+// the skipped bounds are summed into error_bound.
+struct ScreenedArgs{
+    int n;
+    int l;
+    coord_t actual_l;
+    coord_t idx;
+    coord_t end_idx;
+    TreeLayout layout1, layout2;
+    double tolerance;
+    ScreenedArgs(int _n, int _l, coord_t _actual_l, coord_t _idx, coord_t _end_idx, TreeLayout _layout1, TreeLayout _layout2, double _tolerance )
+        : n(_n), l(_l), actual_l(_actual_l), idx(_idx), end_idx(_end_idx), layout1(_layout1), layout2(_layout2), tolerance(_tolerance) {}
+};
+
+struct InnerProductEstimate{
+    int estimate;
+    double error_bound;
+    InnerProductEstimate( int _estimate=0, double _error_bound=0 ) : estimate(_estimate), error_bound(_error_bound) {}
+};
+
+// One node of the common refinement of two trees. A side that is already a
+// leaf is null below it and its value is pushed down as pass, halved per level
+// for a sum. With multiply the leaves of the common refinement take the
+// product instead, so f*g needs no reconstructed copies of f and g refined to
+// a shared shape; the pushed value is then f's value on the finer node and
+// goes down unchanged, or the product would depend on how f was refined.
+struct GaxpyStep{
+    int value;
+    bool is_leaf;
+    int child_pass;
+    bool child_left_null, child_right_null;
+    GaxpyStep( int pass, bool left_null, bool right_null, bool leaf1, bool leaf2, int value1, int value2, bool multiply=false )
+        : value(0), is_leaf(false), child_pass(0), child_left_null(left_null), child_right_null(right_null)
+    {
+        if( left_null ){
+            if( leaf2 ){
+                value = multiply ? pass * value2 : pass + value2;
+                is_leaf = true;
+            }
+            else
+                child_pass = multiply ? pass : pass/2;
+        }
+        else if( right_null ){
+            if( leaf1 ){
+                value = multiply ? pass * value1 : pass + value1;
+                is_leaf = true;
+            }
+            else
+                child_pass = multiply ? pass : pass/2;
+        }
+        else if( leaf1 && leaf2 ){
+            value = multiply ? value1 * value2 : value1 + value2;
+            is_leaf = true;
+        }
+        else if( leaf1 ){
+            child_pass = multiply ? value1 : value1/2;
+            child_left_null = true;
+        }
+        else if( leaf2 ){
+            child_pass = multiply ? value2 : value2/2;
+            child_right_null = true;
+        }
+    }
+};
+
+coord_t layout_node_index( const TreeLayout &layout, int n, coord_t l ){
+    coord_t start = layout.base;
+    int k = 0;
+    int th = layout.tile_height;
+    while( k + th <= n ){
+        coord_t sub_tree_size = (1LL<<(layout.max_depth-k-th))-1;
+        coord_t child = (l>>(n-k-th)) & ((1LL<<th)-1);
+        start += ((1LL<<th)-1) + child*sub_tree_size;
+        k += th;
+    }
+    int d = n-k;
+    return start + (l & ((1LL<<d)-1)) + (1LL<<d)-1;
+}
+
+pair<coord_t,coord_t> layout_subtree_range( const TreeLayout &layout, int n, coord_t l ){
+    int k = (n/layout.tile_height)*layout.tile_height;
+    coord_t start = layout_node_index(layout, k, l>>(n-k));
+    return make_pair(start, start + (1LL<<(layout.max_depth-k))-2);
+}
+
+// The tiles of layout holding levels n..n+height-1 below (n,l): the tile
+// containing (n,l) and every tile rooted under it above level n+height.
+vector<Domain> layout_tile_overlap( const TreeLayout &layout, int n, coord_t l, int height ){
+    vector<Domain> tiles;
+    int th = layout.tile_height;
+    int end = min(n+height, layout.max_depth);
+    for( int k = (n/th)*th ; k < end ; k += th ){
+        coord_t tile_size = (1LL<<min(th, layout.max_depth-k))-1;
+        coord_t first = k < n ? l>>(n-k) : l<<(k-n);
+        coord_t last = k < n ? first : ((l+1)<<(k-n))-1;
+        for( coord_t q = first ; q <= last ; q++ ){
+            coord_t start = layout_node_index(layout, k, q);
+            tiles.push_back(Rect<1>(start, start+tile_size-1));
+        }
+    }
+    return tiles;
+}
+
+// Subregion of lr made of the layout tiles an intra task at (n,l) reads, so
+// a tile of one tree maps only the overlapping tiles of another tree.
+LogicalRegion tile_overlap_region( Context ctx, HighLevelRuntime *runtime, ScratchResources &scratch, LogicalRegion lr, const TreeLayout &layout, int n, coord_t l, int height ){
+    vector<Domain> tiles = layout_tile_overlap(layout, n, l, height);
+    MultiDomainPointColoring coloring;
+    coloring[0].insert(tiles.begin(), tiles.end());
+    IndexPartition ip = scratch.adopt(runtime->create_index_partition(ctx, lr.get_index_space(), Rect<1>(0,0), coloring, DISJOINT_KIND));
+    return runtime->get_logical_subregion_by_color(ctx, runtime->get_logical_partition(ctx, lr, ip), 0);
+}
+
+struct DiffArgs{
+    int n;
+    coord_t actual_l;
+    coord_t idx;
+    coord_t end_idx;
+    TreeLayout layout;
+    bool left_exists, right_exists;
+    int left_cover, right_cover;
+    bool launch;
+    DiffArgs( int _n, coord_t _actual_l, coord_t _idx, coord_t _end_idx, TreeLayout _layout, bool _left_exists=false, bool _right_exists=false, int _left_cover=0, int _right_cover=0 )
+        : n(_n), actual_l(_actual_l), idx(_idx), end_idx(_end_idx), layout(_layout), left_exists(_left_exists), right_exists(_right_exists), left_cover(_left_cover), right_cover(_right_cover), launch(true) {}
+};
+
+// Slot of level-k position p within the [left ghost | own tile | right ghost]
+// scan of the tile rooted at (args.n, args.actual_l), or -1 past the domain edge.
+int diff_slot( const DiffArgs &args, int tile_nodes, int k, coord_t p ){
+    if( p < 0 || p >= (1LL<<(args.n+k)) )
+        return -1;
+    int t = (int)((p>>k) - args.actual_l) + 1;
+    coord_t j = p - ((p>>k)<<k);
+    return t*tile_nodes + j + (1<<k)-1;
+}
+
+// Functions refine can be driven by, defined on [0,1]. Each one evaluates a
+// whole batch of points per call, so the quadrature for a tile is a single
+// loop the compiler can vectorize. Entry 0 keeps the random refinement.
+typedef void (*BatchFunction)( const double *x, double *y, size_t count );
+
+void gaussian_batch( const double *x, double *y, size_t count ){
+    for( size_t i = 0 ; i < count ; i++ )
+        y[i] = exp(-400*(x[i]-0.5)*(x[i]-0.5));
+}
+
+void sine_batch( const double *x, double *y, size_t count ){
+    for( size_t i = 0 ; i < count ; i++ )
+        y[i] = sin(16*M_PI*x[i]*x[i]);
+}
+
+void step_batch( const double *x, double *y, size_t count ){
+    for( size_t i = 0 ; i < count ; i++ )
+        y[i] = x[i] < 1.0/3 ? 1 : 0;
+}
+
+struct RefineFunction{
+    const char *name;
+    BatchFunction eval;
+};
+
+static const RefineFunction refine_functions[] = { {"random", NULL}, {"gaussian", gaussian_batch}, {"sine", sine_batch}, {"step", step_batch} };
+
+int find_refine_function( const char *name ){
+    for( size_t i = 0 ; i < sizeof(refine_functions)/sizeof(refine_functions[0]) ; i++ )
+        if( strcmp(refine_functions[i].name, name) == 0 )
+            return i;
+    return -1;
+}
+
+// Function-driven nodes store round(FUNCTION_SCALE * average of f).
+#define FUNCTION_SCALE 100
+#define QUADRATURE_POINTS 3
+
+static const double quadrature_point[QUADRATURE_POINTS] = { -0.7745966692414834, 0, 0.7745966692414834 };
+static const double quadrature_weight[QUADRATURE_POINTS] = { 5.0/9, 8.0/9, 5.0/9 };
+
+struct NodeSample{
+    double average;
+    double error;
+};
+
+// Samples f on both halves of every node of the tile rooted at (n, actual_l)
+// with one batched call. error is the L2 error of keeping the node as a leaf,
+// i.e. of replacing f by its average over the node.
+vector<NodeSample> sample_tile( BatchFunction f, int n, coord_t actual_l, int tile_height ){
+    int tile_nodes = (1<<tile_height)-1;
+    int per_node = 2*QUADRATURE_POINTS;
+    vector<double> x(tile_nodes*per_node), y(tile_nodes*per_node), width(tile_nodes);
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        int depth = 0;
+        while( (2<<depth) <= i+1 )
+            depth++;
+        coord_t node_l = (actual_l<<depth) + (i+1-(1<<depth));
+        width[i] = 1.0/(1LL<<(n+depth));
+        for( int half = 0 ; half < 2 ; half++ ){
+            double center = (node_l+0.25+0.5*half)*width[i];
+            for( int q = 0 ; q < QUADRATURE_POINTS ; q++ )
+                x[i*per_node+half*QUADRATURE_POINTS+q] = center+0.25*width[i]*quadrature_point[q];
+        }
+    }
+    f(&x[0], &y[0], x.size());
+    vector<NodeSample> samples(tile_nodes);
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        double half_average[2] = {0, 0};
+        for( int half = 0 ; half < 2 ; half++ )
+            for( int q = 0 ; q < QUADRATURE_POINTS ; q++ )
+                half_average[half] += 0.5*quadrature_weight[q]*y[i*per_node+half*QUADRATURE_POINTS+q];
+        samples[i].average = 0.5*(half_average[0]+half_average[1]);
+        double error = 0;
+        for( int q = 0 ; q < 2*QUADRATURE_POINTS ; q++ ){
+            double residual = y[i*per_node+q]-samples[i].average;
+            error += 0.25*width[i]*quadrature_weight[q%QUADRATURE_POINTS]*residual*residual;
+        }
+        samples[i].error = sqrt(error);
+    }
+    return samples;
+}
+
+#define APPLY_SCALE 64
+
+struct ApplySource{
+    coord_t l;
+    int bound;
+    ApplySource( coord_t _l=0, int _bound=0 ) : l(_l), bound(_bound) {}
+};
+
+struct ApplyArgs{
+    int n;
+    coord_t target_l;
+    coord_t idx;
+    coord_t end_idx;
+    TreeLayout layout;
+    int tolerance;
+    int sources;
+    ApplyArgs( int _n, coord_t _target_l, coord_t _idx, coord_t _end_idx, TreeLayout _layout, int _tolerance, int _sources=0 )
+        : n(_n), target_l(_target_l), idx(_idx), end_idx(_end_idx), layout(_layout), tolerance(_tolerance), sources(_sources) {}
+};
+
+struct ApplyCandidate{
+    int child;
+    coord_t target_l;
+    coord_t idx;
+    coord_t end_idx;
+    ApplySource source;
+    bool launch;
+    ApplyCandidate( int _child, coord_t _target_l, coord_t _idx, coord_t _end_idx, ApplySource _source ) : child(_child), target_l(_target_l), idx(_idx), end_idx(_end_idx), source(_source), launch(true) {}
+};
+
+// Toy Green's function: decays with the squared box distance at a level.
+int apply_kernel( int value, coord_t distance ){
+    return (int)((APPLY_SCALE*(long long) value)/((distance+1)*(distance+1)));
+}
+
+// A source tile whose compressed norm bound cannot reach the tolerance even
+// at the closest box distance the two tiles allow is screened out.
+bool apply_screened( int bound, coord_t distance, int tolerance ){
+    return distance > 0 && apply_kernel(abs(bound), distance-1) < tolerance;
+}
+
+vector<char> pack_apply_args( ApplyArgs args, const vector<ApplySource> &sources ){
+    args.sources = sources.size();
+    vector<char> buffer(sizeof(ApplyArgs)+sources.size()*sizeof(ApplySource));
+    memcpy(&buffer[0], &args, sizeof(ApplyArgs));
+    if( sources.size() > 0 )
+        memcpy(&buffer[sizeof(ApplyArgs)], &sources[0], sources.size()*sizeof(ApplySource));
+    return buffer;
+}
+
+ApplyArgs unpack_apply_args( const Task *task, vector<ApplySource> &sources ){
+    const char *buffer = task->is_index_space ? (const char *) task->local_args : (const char *) task->args;
+    ApplyArgs args = *(const ApplyArgs *) buffer;
+    const ApplySource *first = (const ApplySource *)(buffer+sizeof(ApplyArgs));
+    sources.assign(first, first+args.sources);
+    return args;
+}
+
+typedef unsigned long long NodeKey;
+
+int key_level( NodeKey key ){
+    return 63 - __builtin_clzll(key);
+}
+
+NodeKey key_mix( NodeKey key ){
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Counter-based draw for refinement: a pure function of the tree's seed and
+// the node's level and position, so no RNG state is shared between tasks and
+// a tree comes out the same on any core count or tile height.
+long int node_random( long int seed, int n, NodeKey l ){
+    NodeKey key = key_mix((NodeKey) seed + 0x9e3779b97f4a7c15ULL);
+    key = key_mix(key ^ ((NodeKey) n << 56) ^ l);
+    return (long int)(key >> 33);
+}
+
+// Merkle hash of a subtree: the node's value and leaf bit mixed with its
+// children's hashes. Position and lval stay out, so equal contents hash the
+// same wherever they sit. 0 is kept for stale, and an internal node with a
+// stale child is stale itself.
+unsigned long long node_hash( const TreeArgs &node, unsigned long long left, unsigned long long right ){
+    if( !node.is_leaf && ( left == 0 || right == 0 ) )
+        return 0;
+    NodeKey key = key_mix(((NodeKey)(unsigned int) node.value << 1) ^ (NodeKey) node.is_leaf ^ 0x9e3779b97f4a7c15ULL);
+    key = key_mix(key ^ left);
+    key = key_mix(key + right);
+    return key == 0 ? 1 : key;
+}
+
+// A leaf's hash follows from the node alone, so a leaf written without one
+// (gaxpy, truncate) still has it.
+unsigned long long subtree_hash( const TreeArgs &node ){
+    return node.is_leaf ? node_hash(node, 0, 0) : node.hash;
+}
+
+// The same for height, which is -1 wherever the hash is stale.
+int subtree_height( const TreeArgs &node ){
+    if( node.is_leaf )
+        return 0;
+    return node.hash != 0 ? node.height : -1;
+}
+
+int parent_height( int left, int right ){
+    return left < 0 || right < 0 ? -1 : 1+max(left, right);
+}
+
+// What the rehash of a tile needs from a child subtree's root: its hash and
+// height in each field the subtree was written in, a pair having two. The
+// tasks that write subtrees return it, so the tile above is rehashed from
+// their futures without mapping anything below it.
+#define MAX_TREE_FIELDS 2
+
+struct SubtreeRoot{
+    int fields;
+    unsigned long long hash[MAX_TREE_FIELDS];
+    int height[MAX_TREE_FIELDS];
+    SubtreeRoot() : fields(0) {}
+    template<typename TREE_ACC>
+    void add( const TREE_ACC &tree_acc, coord_t idx ){
+        hash[fields] = subtree_hash(tree_acc[idx]);
+        height[fields] = subtree_height(tree_acc[idx]);
+        fields++;
+    }
+    TreeArgs node( int field ) const {
+        TreeArgs root(0, 0);
+        root.hash = hash[field];
+        root.height = height[field];
+        return root;
+    }
+};
+
+struct SubtreeRootBatch{
+    int count;
+    SubtreeRoot member[MAX_SERIAL_BATCH];
+    SubtreeRootBatch() : count(0) {}
+};
+
+// Rehashes tile once its child subtrees are written. children are the
+// futures of the tasks that wrote them, in launch order: SubtreeRoots, or
+// SubtreeRootBatches from serial batches of width args.width. The task waits
+// on them instead of mapping the child roots, so nothing below the tile is
+// partitioned or mapped for it. tree is the inter task's requirement the
+// fields come from. Returns the tile root for the caller's own parent.
+SubtreeRoot rehash_tile( Context ctx, HighLevelRuntime *runtime, const Task *task, int tree, LogicalRegion tile, LogicalRegion parent, const TileHashArgs &args, const vector<Future> &children ){
+    TaskLauncher hash_launcher(HASH_TILE_TASK_ID, TaskArgument(&args, sizeof(TileHashArgs)));
+    hash_launcher.tag = subtree_priority(args.max_depth, args.n);
+    hash_launcher.add_region_requirement(RegionRequirement(tile, READ_WRITE, EXCLUSIVE, parent));
+    add_tree_fields(hash_launcher.region_requirements[0], task, tree);
+    for( size_t c = 0 ; c < children.size() ; c++ )
+        hash_launcher.add_future(children[c]);
+    return execute_resident(ctx, runtime, hash_launcher).get_result<SubtreeRoot>();
+}
+
+vector<Future> point_futures( const FutureMap &result, int points ){
+    vector<Future> futures;
+    for( int i = 0 ; i < points ; i++ )
+        futures.push_back(result.get_future(i));
+    return futures;
+}
+
+// Results of norms and inner products, keyed by the hashes of the subtrees
+// they were taken over. norm(f) is inner(f,f) and is stored under (h,h).
+// The cache is per process and split into shards by key so concurrent tasks
+// rarely share a lock; each shard evicts its least recently used entry once
+// it holds its share of PRODUCT_CACHE_LIMIT.
+#define PRODUCT_CACHE_LIMIT (1<<20)
+#define PRODUCT_CACHE_SHARDS 64
+
+typedef pair<unsigned long long,unsigned long long> ProductKey;
+
+struct ProductCacheShard{
+    mutex lock;
+    list<pair<ProductKey,int> > recent;
+    map<ProductKey,list<pair<ProductKey,int> >::iterator> entries;
+};
+
+static ProductCacheShard product_cache[PRODUCT_CACHE_SHARDS];
+
+ProductKey product_key( unsigned long long hash1, unsigned long long hash2 ){
+    return make_pair(min(hash1, hash2), max(hash1, hash2));
+}
+
+ProductCacheShard &product_shard( const ProductKey &key ){
+    return product_cache[key_mix(key.first ^ (key.second * 0x9e3779b97f4a7c15ULL)) % PRODUCT_CACHE_SHARDS];
+}
+
+bool lookup_product( unsigned long long hash1, unsigned long long hash2, int &result ){
+    if( hash1 == 0 || hash2 == 0 )
+        return false;
+    ProductKey key = product_key(hash1, hash2);
+    ProductCacheShard &shard = product_shard(key);
+    lock_guard<mutex> lock(shard.lock);
+    map<ProductKey,list<pair<ProductKey,int> >::iterator>::iterator it = shard.entries.find(key);
+    if( it == shard.entries.end() )
+        return false;
+    shard.recent.splice(shard.recent.begin(), shard.recent, it->second);
+    result = it->second->second;
+    return true;
+}
+
+void store_product( unsigned long long hash1, unsigned long long hash2, int result ){
+    if( hash1 == 0 || hash2 == 0 )
+        return;
+    ProductKey key = product_key(hash1, hash2);
+    ProductCacheShard &shard = product_shard(key);
+    lock_guard<mutex> lock(shard.lock);
+    map<ProductKey,list<pair<ProductKey,int> >::iterator>::iterator it = shard.entries.find(key);
+    if( it != shard.entries.end() ){
+        it->second->second = result;
+        shard.recent.splice(shard.recent.begin(), shard.recent, it->second);
+        return;
+    }
+    shard.recent.push_front(make_pair(key, result));
+    shard.entries[key] = shard.recent.begin();
+    if( shard.entries.size() > PRODUCT_CACHE_LIMIT / PRODUCT_CACHE_SHARDS ){
+        shard.entries.erase(shard.recent.back().first);
+        shard.recent.pop_back();
+    }
+}
+
+// One intra task's share of a norm or inner product, with the hashes of the
+// tile roots so the inter task can store the subtree total. cached means the
+// whole subtree came from the cache and nothing below the tile was queued.
+struct TileProduct{
+    int value;
+    unsigned long long hash1, hash2;
+    bool cached;
+    TileProduct( int _value=0, unsigned long long _hash1=0, unsigned long long _hash2=0, bool _cached=false ) : value(_value), hash1(_hash1), hash2(_hash2), cached(_cached) {}
+};
+
+struct HashLayout{
+    int max_depth;
+    int shard_level;
+    int shards;
+    coord_t capacity;
+    Color partition_color;
+    HashLayout( int _max_depth=0, int _shard_level=0, int _shards=1, coord_t _capacity=1, Color _partition_color=0 ) : max_depth(_max_depth), shard_level(_shard_level), shards(_shards), capacity(_capacity), partition_color(_partition_color) {}
+    int table_of( NodeKey key ) const {
+        int n = key_level(key);
+        if( n < shard_level )
+            return shards;
+        return key_mix(key>>(n-shard_level)) % shards;
+    }
+    bool aligned( const HashLayout &other ) const { return shards == other.shards && shard_level == other.shard_level; }
+};
+
+struct HashNode{
+    NodeKey key;
+    int value;
+    bool is_leaf;
+    HashNode( NodeKey _key=0, int _value=0, bool _is_leaf=false ) : key(_key), value(_value), is_leaf(_is_leaf) {}
+};
+
+struct HashFrontier{
+    NodeKey key;
+    int pass;
+    bool left_null, right_null;
+    HashFrontier( NodeKey _key=0, int _pass=0, bool _left_null=false, bool _right_null=false ) : key(_key), pass(_pass), left_null(_left_null), right_null(_right_null) {}
+};
+
+struct HashArgs{
+    HashLayout layout1, layout2, layout3;
+    int stop_level;
+    int table;
+    int count;
+    long int gen;
+    HashArgs( HashLayout _layout1, HashLayout _layout2=HashLayout(), HashLayout _layout3=HashLayout(), int _stop_level=0, int _table=0, int _count=0 ) : layout1(_layout1), layout2(_layout2), layout3(_layout3), stop_level(_stop_level), table(_table), count(_count), gen(0) {}
+};
+
+template<typename ACC>
+coord_t hash_find( const ACC &acc, const HashLayout &layout, NodeKey key ){
+    coord_t base = layout.table_of(key)*layout.capacity;
+    coord_t slot = (key_mix(key)>>16) % layout.capacity;
+    for( coord_t probe = 0 ; probe < layout.capacity ; probe++ ){
+        coord_t idx = base + (slot+probe) % layout.capacity;
+        if( acc[idx].key == key )
+            return idx;
+        if( acc[idx].key == 0 )
+            return -1;
+    }
+    return -1;
+}
+
+template<typename ACC>
+coord_t hash_insert( const ACC &acc, const HashLayout &layout, NodeKey key ){
+    coord_t base = layout.table_of(key)*layout.capacity;
+    coord_t slot = (key_mix(key)>>16) % layout.capacity;
+    for( coord_t probe = 0 ; probe < layout.capacity ; probe++ ){
+        coord_t idx = base + (slot+probe) % layout.capacity;
+        if( acc[idx].key == key || acc[idx].key == 0 ){
+            acc[idx].key = key;
+            return idx;
+        }
+    }
+    // Dropping the node would leave its parent pointing at nothing, so a
+    // full table stops the run instead.
+    cerr<<"Hash table "<<layout.table_of(key)<<" is full at "<<layout.capacity<<" nodes inserting "<<key<<", rerun with a larger -hash_capacity"<<endl;
+    abort();
+}
+
+vector<char> pack_hash_args( HashArgs args, const vector<HashFrontier> &frontier ){
+    args.count = frontier.size();
+    vector<char> buffer(sizeof(HashArgs)+frontier.size()*sizeof(HashFrontier));
+    memcpy(&buffer[0], &args, sizeof(HashArgs));
+    if( frontier.size() > 0 )
+        memcpy(&buffer[sizeof(HashArgs)], &frontier[0], frontier.size()*sizeof(HashFrontier));
+    return buffer;
+}
+
+const char *hash_task_args( const Task *task ){
+    return task->is_index_space ? (const char *) task->local_args : (const char *) task->args;
+}
+
+struct HashRegions{
+    LogicalPartition tables;
+    LogicalRegion top, shards;
+};
+
+HashRegions get_hash_regions( Context ctx, HighLevelRuntime *runtime, LogicalRegion lr, const HashLayout &layout ){
+    HashRegions hr;
+    hr.tables = runtime->get_logical_partition_by_color(ctx, lr, layout.partition_color);
+    hr.top = runtime->get_logical_subregion_by_color(ctx, hr.tables, layout.shards);
+    LogicalPartition split = runtime->get_logical_partition_by_color(ctx, lr, layout.partition_color+1);
+    hr.shards = runtime->get_logical_subregion_by_color(ctx, split, 0);
+    return hr;
+}
+
+LogicalRegion create_hash_store( Context ctx, HighLevelRuntime *runtime, const HashLayout &layout ){
+    coord_t table_space = layout.capacity*(layout.shards+1);
+    Rect<1> store_rect(0LL, table_space-1);
+    IndexSpace is = runtime->create_index_space(ctx, store_rect);
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(HashNode), FID_X);
+    }
+    LogicalRegion lr = runtime->create_logical_region(ctx, is, fs);
+    DomainPointColoring coloring;
+    for( int i = 0 ; i <= layout.shards ; i++ ){
+        coloring[i] = Rect<1>(i*layout.capacity, (i+1)*layout.capacity-1);
+    }
+    runtime->create_index_partition(ctx, is, Rect<1>(0, layout.shards), coloring, DISJOINT_KIND, layout.partition_color);
+    DomainPointColoring split;
+    split[0] = Rect<1>(0, layout.shards*layout.capacity-1);
+    split[1] = Rect<1>(layout.shards*layout.capacity, table_space-1);
+    runtime->create_index_partition(ctx, is, Rect<1>(0, 1), split, DISJOINT_KIND, layout.partition_color+1);
+    runtime->fill_field<HashNode>(ctx, lr, lr, FID_X, HashNode());
+    return lr;
+}
+
+void write_hash_frontier( const PhysicalRegion &region, const vector<HashFrontier> &frontier ){
+    const FieldAccessor<WRITE_DISCARD,HashFrontier,1,coord_t,Realm::AffineAccessor<HashFrontier,1,coord_t> > helper_acc(region, FID_X);
+    for( size_t i = 0 ; i < frontier.size() ; i++ )
+        helper_acc[i] = frontier[i];
+    helper_acc[frontier.size()] = HashFrontier();
+}
+
+vector<HashFrontier> hash_top_pass( Context ctx, HighLevelRuntime *runtime, TaskID task_id, const HashArgs &args, const HashLayout &layout, const HashFrontier &root, const vector<RegionRequirement> &reqs ){
+    vector<HashFrontier> frontier;
+    if( layout.shard_level == 0 ){
+        frontier.push_back(root);
+        return frontier;
+    }
+    ScratchResources scratch(ctx, runtime);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(1LL<<layout.shard_level));
+    LogicalRegion new_helper_Region = scratch.create_region<HashFrontier>(helper_Array);
+    HashArgs top_args = args;
+    top_args.stop_level = layout.shard_level;
+    top_args.table = layout.shards;
+    vector<char> buffer = pack_hash_args(top_args, vector<HashFrontier>(1, root));
+    TaskLauncher top_launcher(task_id, TaskArgument(&buffer[0], buffer.size()));
+    for( size_t i = 0 ; i < reqs.size() ; i++ )
+        top_launcher.add_region_requirement(reqs[i]);
+    RegionRequirement helper_req(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    helper_req.add_field(FID_X);
+    top_launcher.add_region_requirement(helper_req);
+    execute_resident(ctx, runtime, top_launcher);
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HashFrontier,1,coord_t,Realm::AffineAccessor<HashFrontier,1,coord_t> > read_acc(physicalRegion, FID_X);
+    for( coord_t i = 0 ; read_acc[i].key != 0 ; i++ )
+        frontier.push_back(read_acc[i]);
+    runtime->unmap_region(ctx, physicalRegion);
+    return frontier;
+}
+
+FutureMap hash_shard_launch( Context ctx, HighLevelRuntime *runtime, TaskID task_id, const HashArgs &args, const HashLayout &layout, int points, const vector<HashFrontier> &frontier, const vector<RegionRequirement> &reqs ){
+    vector<vector<HashFrontier> > per_table(points);
+    for( size_t i = 0 ; i < frontier.size() ; i++ )
+        per_table[layout.table_of(frontier[i].key)].push_back(frontier[i]);
+    vector<vector<char> > buffers(points);
+    ArgumentMap arg_map;
+    for( int t = 0 ; t < points ; t++ ){
+        HashArgs shard_args = args;
+        shard_args.stop_level = layout.max_depth+1;
+        shard_args.table = t;
+        buffers[t] = pack_hash_args(shard_args, per_table[t]);
+        arg_map.set_point(t, TaskArgument(&buffers[t][0], buffers[t].size()));
+    }
+    Rect<1> launch_domain(0, points-1);
+    IndexTaskLauncher shard_launcher(task_id, launch_domain, TaskArgument(NULL, 0), arg_map);
+    for( size_t i = 0 ; i < reqs.size() ; i++ )
+        shard_launcher.add_region_requirement(reqs[i]);
+    return execute_resident(ctx, runtime, shard_launcher);
+}
+
+RegionRequirement hash_requirement( LogicalRegion region, PrivilegeMode mode, LogicalRegion parent ){
+    RegionRequirement req(region, mode, EXCLUSIVE, parent);
+    req.add_field(FID_X);
+    return req;
+}
+
+RegionRequirement hash_requirement( LogicalPartition partition, PrivilegeMode mode, LogicalRegion parent ){
+    RegionRequirement req(partition, 0, mode, EXCLUSIVE, parent);
+    req.add_field(FID_X);
+    return req;
+}
+
+
+
+// compressed tracks whether the values are compress's sums or the
+// reconstructed leaf values, for the operations that need one of the two.
+struct ScriptTree{
+    LogicalRegion lr;
+    Arguments args;
+    FieldID field;
+    bool compressed;
+    ScriptTree( LogicalRegion _lr, Arguments _args, FieldID _field=FID_X ) : lr(_lr), args(_args), field(_field), compressed(false) {}
+};
+
+// A result line can carry a check: an answer it has to print (same), or a
+// second computation it has to equal (inner, norm), in which case reference
+// holds that computation's future.
+struct ScriptResult{
+    string label;
+    Future result;
+    bool is_norm;
+    bool is_estimate;
+    bool is_same;
+    string expected;
+    Future reference;
+    bool has_reference;
+    ScriptResult( string _label, Future _result, bool _is_norm, bool _is_estimate=false, bool _is_same=false ) : label(_label), result(_result), is_norm(_is_norm), is_estimate(_is_estimate), is_same(_is_same), has_reference(false) {}
+};
+
+// Out-of-core mode: a tree's home copy is a file under spill_directory, so
+// only the tiles execute_resident has acquired for some intra or serial task
+// take up memory.
+struct SpilledTree{
+    PhysicalRegion instance;
+    string path;
+};
+
+static const char *spill_directory = NULL;
+static map<LogicalRegion,SpilledTree> spilled_trees;
+static int spilled_tree_count = 0;
+
+// A tree region on an existing index space, which keeps every tile partition
+// already built on it; a spilled run backs it with a file of its own.
+LogicalRegion create_tree_region( Context ctx, HighLevelRuntime *runtime, IndexSpace is, const vector<FieldID> &fields=vector<FieldID>(1, FID_X) ){
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        for( size_t f = 0 ; f < fields.size() ; f++ )
+            allocator.allocate_field(sizeof(TreeArgs), fields[f]);
+    }
+    LogicalRegion lr = runtime->create_logical_region(ctx, is, fs);
+    if( spill_directory != NULL ){
+        ostringstream path;
+        path<<spill_directory<<"/tree_"<<getpid()<<"_"<<spilled_tree_count++<<".bin";
+        SpilledTree &spilled = spilled_trees[lr];
+        spilled.path = path.str();
+        AttachLauncher attach_launcher(EXTERNAL_POSIX_FILE, lr, lr);
+        attach_launcher.attach_file(spilled.path.c_str(), fields, LEGION_FILE_CREATE);
+        spilled.instance = runtime->attach_external_resource(ctx, attach_launcher);
+        lock_guard<mutex> guard(spilled_tree_lock);
+        spilled_tree_ids.insert(lr.get_tree_id());
+    }
+    return lr;
+}
+
+// bounds is the whole region: one tree's slots, or every slot of an ensemble.
+LogicalRegion create_tree_region( Context ctx, HighLevelRuntime *runtime, const Rect<1> &bounds, const vector<FieldID> &fields=vector<FieldID>(1, FID_X) ){
+    return create_tree_region(ctx, runtime, runtime->create_index_space(ctx, bounds), fields);
+}
+
+LogicalRegion create_tree_region( Context ctx, HighLevelRuntime *runtime, int max_depth, const vector<FieldID> &fields=vector<FieldID>(1, FID_X) ){
+    return create_tree_region(ctx, runtime, Rect<1>(0LL, static_cast<coord_t>(pow(2, max_depth))), fields);
+}
+
+void destroy_tree_region( Context ctx, HighLevelRuntime *runtime, LogicalRegion lr, bool destroy_space=true ){
+    map<LogicalRegion,SpilledTree>::iterator spilled = spilled_trees.find(lr);
+    if( spilled != spilled_trees.end() ){
+        runtime->detach_external_resource(ctx, spilled->second.instance, false).get_void_result();
+        remove(spilled->second.path.c_str());
+        spilled_trees.erase(spilled);
+        lock_guard<mutex> guard(spilled_tree_lock);
+        spilled_tree_ids.erase(lr.get_tree_id());
+    }
+    runtime->destroy_logical_region(ctx, lr);
+    runtime->destroy_field_space(ctx, lr.get_field_space());
+    if( destroy_space )
+        runtime->destroy_index_space(ctx, lr.get_index_space());
+}
+
+// A script's named trees and not-yet-printed results. run_script feeds it the
+// lines of a file; run_service keeps one alive across client requests so the
+// trees stay resident between queries.
+struct ScriptSession{
+    Context ctx;
+    HighLevelRuntime *runtime;
+    int tile_height;
+    coord_t serial_cutoff;
+    bool resource_report;
+    map<string,ScriptTree> trees;
+    map<LogicalRegion,int> region_users;
+    map<pair<LogicalRegion,FieldID>,int> data_users;
+    map<IndexSpace,int> space_users;
+    vector<ScriptResult> results;
+    Color next_color;
+    // Where execute reports a bad line; the service points it at the client.
+    ostream *errors;
+    int failed_checks;
+    ScriptSession( Context _ctx, HighLevelRuntime *_runtime, int _tile_height, coord_t _serial_cutoff, bool _resource_report )
+        : ctx(_ctx), runtime(_runtime), tile_height(_tile_height), serial_cutoff(_serial_cutoff), resource_report(_resource_report), next_color(10), errors(&cerr), failed_checks(0) {}
+    void add_tree( const string &name, LogicalRegion lr, const Arguments &args, FieldID field=FID_X );
+    void release( const ScriptTree &tree );
+    void make_writable( ScriptTree &tree, bool reshapes );
+    void rebind( ScriptTree &tree, LogicalRegion lr, FieldID field );
+    Future norm( const ScriptTree &tree );
+    Future inner_product( const ScriptTree &tree1, const ScriptTree &tree2 );
+    void execute( const string &line, const string &where );
+    string collect( bool ready_only );
+    void close();
+};
+
+// A pair adds two names on one region; space_users counts regions, so only
+// the first name of a region counts against its index space.
+void ScriptSession::add_tree( const string &name, LogicalRegion lr, const Arguments &args, FieldID field ){
+    trees.insert(make_pair(name, ScriptTree(lr, args, field)));
+    data_users[make_pair(lr, field)]++;
+    if( region_users[lr]++ == 0 )
+        space_users[lr.get_index_space()]++;
+}
+
+// Drops one name's hold on a region; the index space, and with it the tile
+// partitions, goes only once no snapshot region is built on it any more.
+void ScriptSession::release( const ScriptTree &tree ){
+    LogicalRegion lr = tree.lr;
+    if( --data_users[make_pair(lr, tree.field)] == 0 )
+        data_users.erase(make_pair(lr, tree.field));
+    if( --region_users[lr] > 0 )
+        return;
+    region_users.erase(lr);
+    bool last = --space_users[lr.get_index_space()] == 0;
+    if( last )
+        space_users.erase(lr.get_index_space());
+    destroy_tree_region(ctx, runtime, lr, last);
+}
+
+// Snapshots are copy-on-write: "snapshot NEW OLD" only adds a name for OLD's
+// region. The first write through either name copies the tree into a region
+// of its own, made by create_tree_region like any other tree so a spilled run
+// backs it with its own file. Compress and reconstruct keep the tree's shape,
+// so the copy reuses the index space and every tile partition already built
+// on it; truncate reshapes the partitions, so it gets a fresh index space
+// whose partitions partition_inter_task rebuilds tile by tile from the copy. The other half of a pair shares
+// the partitions too, so truncating either half also moves it out.
+void ScriptSession::make_writable( ScriptTree &tree, bool reshapes ){
+    LogicalRegion lr = tree.lr;
+    IndexSpace is = lr.get_index_space();
+    if( data_users[make_pair(lr, tree.field)] == 1 && ( !reshapes || ( region_users[lr] == 1 && space_users[is] == 1 ) ) )
+        return;
+    FieldID field = reshapes ? FID_X : tree.field;
+    LogicalRegion copy = reshapes ? create_tree_region(ctx, runtime, tree.args.max_depth) : create_tree_region(ctx, runtime, is, vector<FieldID>(1, field));
+    CopyLauncher copy_launcher;
+    copy_launcher.add_copy_requirements(RegionRequirement(lr, READ_ONLY, EXCLUSIVE, lr), RegionRequirement(copy, WRITE_DISCARD, EXCLUSIVE, copy));
+    copy_launcher.add_src_field(0, tree.field);
+    copy_launcher.add_dst_field(0, field);
+    runtime->issue_copy_operation(ctx, copy_launcher);
+    if( reshapes ){
+        TaskLauncher partition_launcher(PARTITION_INTER_TASK_ID, TaskArgument(&tree.args, sizeof(Arguments)));
+        partition_launcher.add_region_requirement(RegionRequirement(copy, READ_ONLY, EXCLUSIVE, copy));
+        partition_launcher.add_field(0, FID_X, false);
+        execute_resident(ctx, runtime, partition_launcher);
+    }
+    rebind(tree, copy, field);
+}
+
+// Moves one name onto a region of its own that has just been filled.
+void ScriptSession::rebind( ScriptTree &tree, LogicalRegion lr, FieldID field ){
+    release(tree);
+    tree.lr = lr;
+    tree.field = field;
+    region_users[lr]++;
+    data_users[make_pair(lr, field)]++;
+    space_users[lr.get_index_space()]++;
+}
+
+Future ScriptSession::norm( const ScriptTree &tree ){
+    TaskLauncher norm_launcher(NORM_INTER_TASK_ID, TaskArgument(&tree.args, sizeof(Arguments)));
+    norm_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_ONLY, EXCLUSIVE, tree.lr));
+    norm_launcher.add_field(0, tree.field, false);
+    return execute_resident(ctx, runtime, norm_launcher);
+}
+
+// Trees on one layout take the plain inner product; any other pair is read
+// through the mixed-layout tasks.
+Future ScriptSession::inner_product( const ScriptTree &tree1, const ScriptTree &tree2 ){
+    TreeLayout layout1(tree1.args.max_depth, tree1.args.tile_height, tree1.args.partition_color);
+    TreeLayout layout2(tree2.args.max_depth, tree2.args.tile_height, tree2.args.partition_color);
+    InnerProductArgs args(0, 0, layout1.max_depth, 0, tree1.args.end_idx, layout1.partition_color, layout2.partition_color, 0, layout1.tile_height);
+    args.serial_cutoff = tree1.args.serial_cutoff;
+    args.prefetch = spill_directory != NULL;
+    MixedArgs mixed_args(0, 0, 0, 0, tree1.args.end_idx, layout1, layout2);
+    mixed_args.serial_cutoff = tree1.args.serial_cutoff;
+    TaskLauncher product_launcher(INNER_PRODUCT_INTER_TASK_ID, TaskArgument(&args, sizeof(InnerProductArgs)));
+    if( !(layout1 == layout2) || tree1.args.serial_cutoff != tree2.args.serial_cutoff )
+        product_launcher = TaskLauncher(INNER_PRODUCT_MIXED_INTER_TASK_ID, TaskArgument(&mixed_args, sizeof(MixedArgs)));
+    product_launcher.add_region_requirement(RegionRequirement(tree1.lr, READ_ONLY, EXCLUSIVE, tree1.lr));
+    product_launcher.add_region_requirement(RegionRequirement(tree2.lr, READ_ONLY, EXCLUSIVE, tree2.lr));
+    product_launcher.add_field(0, tree1.field, false);
+    product_launcher.add_field(1, tree2.field, false);
+    return execute_resident(ctx, runtime, product_launcher);
+}
+
+void ScriptSession::execute( const string &line, const string &where ){
+    istringstream in(line);
+    string op;
+    if( !(in>>op) || op[0] == '#' )
+        return;
+    if( op == "refine" || op == "pair" ){
+        // A pair is two trees refined together as FID_X and FID_Y of one
+        // region, so they share one shape and one set of tile partitions.
+        bool paired = op == "pair";
+        string name, pair_name, function_name = "random", pair_function_name = "random";
+        int max_depth, height = tile_height;
+        double refine_tolerance = 1e-3;
+        if( !(in>>name) || ( paired && !(in>>pair_name) ) || !(in>>max_depth) ){
+            if( paired )
+                *errors<<where<<": usage: pair A B MAX_DEPTH [TILE_HEIGHT [FUNCTION_A FUNCTION_B TOL]]"<<endl;
+            else
+                *errors<<where<<": usage: refine NAME MAX_DEPTH [TILE_HEIGHT [FUNCTION TOL]]"<<endl;
+            return;
+        }
+        // A failed extraction stores 0, so the optional numbers are read
+        // through temporaries to keep their defaults when they are absent.
+        int given_height;
+        double given_tolerance;
+        if( in>>given_height )
+            height = given_height;
+        else if( !in.eof() ){
+            *errors<<where<<": tile height must be a number"<<endl;
+            return;
+        }
+        if( max_depth < 1 || height < 1 ){
+            *errors<<where<<": "<<op<<" needs a depth and tile height of at least 1"<<endl;
+            return;
+        }
+        in>>function_name;
+        if( paired )
+            in>>pair_function_name;
+        if( in>>given_tolerance )
+            refine_tolerance = given_tolerance;
+        int function = find_refine_function(function_name.c_str());
+        int pair_function = paired ? find_refine_function(pair_function_name.c_str()) : -1;
+        if( function < 0 || ( paired && pair_function < 0 ) ){
+            *errors<<where<<": unknown function "<<( function < 0 ? function_name : pair_function_name )<<endl;
+            return;
+        }
+        if( trees.count(name) || ( paired && ( trees.count(pair_name) || pair_name == name ) ) ){
+            *errors<<where<<": tree "<<( trees.count(name) ? name : pair_name )<<" already exists"<<endl;
+            return;
+        }
+        vector<FieldID> fields(1, FID_X);
+        if( paired )
+            fields.push_back(FID_Y);
+        LogicalRegion lr = create_tree_region(ctx, runtime, max_depth, fields);
+        Arguments args(0, 0, 0, max_depth, 0, (1LL<<max_depth)-1, next_color, 0, height);
+        next_color += 10;
+        args.gen = rand();
+        args.serial_cutoff = serial_cutoff;
+        args.prefetch = spill_directory != NULL;
+        args.function = function;
+        args.refine_tolerance = refine_tolerance;
+        args.pair_function = pair_function;
+        if( paired )
+            args.pair_gen = rand();
+        TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        refine_launcher.add_region_requirement(RegionRequirement(lr, WRITE_DISCARD, EXCLUSIVE, lr));
+        for( size_t f = 0 ; f < fields.size() ; f++ )
+            refine_launcher.add_field(0, fields[f], false);
+        execute_resident(ctx, runtime, refine_launcher);
+        args.pair_function = -1;
+        add_tree(name, lr, args);
+        if( paired ){
+            Arguments pair_args = args;
+            pair_args.function = pair_function;
+            pair_args.gen = args.pair_gen;
+            add_tree(pair_name, lr, pair_args, FID_Y);
+        }
+        report_operation(ctx, runtime, resource_report, line);
+        return;
+    }
+    vector<string> names;
+    string name;
+    int tolerance = 0, new_tile_height = 0;
+    double screen_tolerance = 0;
+    if( op == "truncate" )
+        in>>name>>tolerance, names.push_back(name);
+    else if( op == "retile" )
+        in>>name>>new_tile_height, names.push_back(name);
+    else if( op == "inner_approx" ){
+        string other;
+        in>>name>>other>>screen_tolerance;
+        names.push_back(name);
+        names.push_back(other);
+    }
+    else if( op == "apply" ){
+        string out;
+        in>>out>>name>>tolerance;
+        names.push_back(out);
+        names.push_back(name);
+    }
+    else
+        while( in>>name )
+            names.push_back(name);
+    size_t expected = ( op == "inner" || op == "inner_approx" || op == "same" || op == "diff" || op == "apply" || op == "snapshot" || op == "accumulate" ) ? 2 : ( op == "gaxpy" || op == "multiply" ) ? 3 : 1;
+    if( names.size() < expected ){
+        *errors<<where<<": "<<op<<" expects "<<expected<<" tree name(s)"<<endl;
+        return;
+    }
+    // The checks: "same A B yes|no|unknown" names the answer, "norm A = B"
+    // and "inner A B = C D" name the trees of a second computation whose
+    // result has to be the same number.
+    vector<string> check;
+    if( ( op == "same" || op == "norm" || op == "inner" ) && names.size() > expected ){
+        check.assign(names.begin()+expected, names.end());
+        names.resize(expected);
+        if( op == "same" ? check.size() != 1 || ( check[0] != "yes" && check[0] != "no" && check[0] != "unknown" )
+            : check.size() != expected+1 || check[0] != "=" ){
+            if( op == "same" )
+                *errors<<where<<": usage: same A B [yes|no|unknown]"<<endl;
+            else if( op == "norm" )
+                *errors<<where<<": usage: norm A [= B]"<<endl;
+            else
+                *errors<<where<<": usage: inner A B [= C D]"<<endl;
+            return;
+        }
+        if( op != "same" )
+            check.erase(check.begin());
+    }
+    bool missing = false;
+    size_t sources = op == "accumulate" ? names.size() : expected;
+    for( size_t i = ( op == "gaxpy" || op == "multiply" || op == "diff" || op == "apply" || op == "snapshot" || op == "accumulate" ) ? 1 : 0 ; i < sources ; i++ ){
+        if( !trees.count(names[i]) ){
+            *errors<<where<<": unknown tree "<<names[i]<<endl;
+            missing = true;
+        }
+    }
+    for( size_t i = 0 ; op != "same" && i < check.size() ; i++ ){
+        if( !trees.count(check[i]) ){
+            *errors<<where<<": unknown tree "<<check[i]<<endl;
+            missing = true;
+        }
+    }
+    if( missing )
+        return;
+    if( op == "compress" ){
+        ScriptTree &tree = trees.find(names[0])->second;
+        make_writable(tree, false);
+        Arguments args = tree.args;
+        TaskLauncher compress_launcher(COMPRESS_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        compress_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_WRITE, EXCLUSIVE, tree.lr));
+        compress_launcher.add_field(0, tree.field, false);
+        execute_resident(ctx, runtime, compress_launcher);
+        tree.compressed = true;
+    }
+    else if( op == "reconstruct" ){
+        ScriptTree &tree = trees.find(names[0])->second;
+        make_writable(tree, false);
+        Arguments args = tree.args;
+        args.carry = 0;
+        TaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        reconstruct_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_WRITE, EXCLUSIVE, tree.lr));
+        reconstruct_launcher.add_field(0, tree.field, false);
+        execute_resident(ctx, runtime, reconstruct_launcher);
+        tree.compressed = false;
+    }
+    else if( op == "truncate" ){
+        ScriptTree &tree = trees.find(names[0])->second;
+        make_writable(tree, true);
+        Arguments args = tree.args;
+        args.tolerance = tolerance;
+        TaskLauncher truncate_launcher(TRUNCATE_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        truncate_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_WRITE, EXCLUSIVE, tree.lr));
+        truncate_launcher.add_field(0, tree.field, false);
+        execute_resident(ctx, runtime, truncate_launcher);
+    }
+    else if( op == "retile" ){
+        ScriptTree &tree = trees.find(names[0])->second;
+        if( new_tile_height < 1 ){
+            *errors<<where<<": retile needs a tile height of at least 1"<<endl;
+            return;
+        }
+        LogicalRegion lr = create_tree_region(ctx, runtime, tree.args.max_depth);
+        Arguments args = tree.args;
+        args.tile_height = new_tile_height;
+        args.partition_color = next_color;
+        next_color += 10;
+        args.source_tile_height = tree.args.tile_height;
+        TaskLauncher retile_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        retile_launcher.add_region_requirement(RegionRequirement(lr, WRITE_DISCARD, EXCLUSIVE, lr));
+        retile_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_ONLY, EXCLUSIVE, tree.lr));
+        retile_launcher.add_field(0, FID_X, false);
+        retile_launcher.add_field(1, tree.field, false);
+        execute_resident(ctx, runtime, retile_launcher);
+        args.source_tile_height = 0;
+        tree.args = args;
+        rebind(tree, lr, FID_X);
+    }
+    else if( op == "norm" ){
+        ScriptResult result("norm "+names[0], norm(trees.find(names[0])->second), true);
+        if( check.size() > 0 ){
+            result.reference = norm(trees.find(check[0])->second);
+            result.has_reference = true;
+        }
+        results.push_back(result);
+    }
+    else if( op == "print" ){
+        ScriptTree &tree = trees.find(names[0])->second;
+        TaskLauncher print_launcher(PRINT_TASK_ID, TaskArgument(&tree.args, sizeof(Arguments)));
+        print_launcher.add_region_requirement(RegionRequirement(tree.lr, READ_ONLY, EXCLUSIVE, tree.lr));
+        print_launcher.add_field(0, tree.field);
+        execute_resident(ctx, runtime, print_launcher);
+    }
+    else if( op == "inner" ){
+        ScriptResult result("inner "+names[0]+" "+names[1], inner_product(trees.find(names[0])->second, trees.find(names[1])->second), false);
+        if( check.size() > 0 ){
+            result.reference = inner_product(trees.find(check[0])->second, trees.find(check[1])->second);
+            result.has_reference = true;
+        }
+        results.push_back(result);
+    }
+    else if( op == "same" ){
+        // Compares the root hashes, so it answers without walking either
+        // tree; "unknown" means one of them has been written since it was
+        // last hashed.
+        ScriptTree &tree1 = trees.find(names[0])->second;
+        ScriptTree &tree2 = trees.find(names[1])->second;
+        Color partition_colors[2] = { tree1.args.partition_color, tree2.args.partition_color };
+        TaskLauncher same_launcher(SAME_TREE_TASK_ID, TaskArgument(partition_colors, sizeof(partition_colors)));
+        same_launcher.add_region_requirement(RegionRequirement(tree1.lr, READ_ONLY, EXCLUSIVE, tree1.lr));
+        same_launcher.add_region_requirement(RegionRequirement(tree2.lr, READ_ONLY, EXCLUSIVE, tree2.lr));
+        same_launcher.add_field(0, tree1.field, false);
+        same_launcher.add_field(1, tree2.field, false);
+        ScriptResult result("same "+names[0]+" "+names[1], execute_resident(ctx, runtime, same_launcher), false, false, true);
+        if( check.size() > 0 )
+            result.expected = check[0];
+        results.push_back(result);
+    }
+    else if( op == "inner_approx" ){
+        ScriptTree &tree1 = trees.find(names[0])->second;
+        ScriptTree &tree2 = trees.find(names[1])->second;
+        TreeLayout layout1(tree1.args.max_depth, tree1.args.tile_height, tree1.args.partition_color);
+        TreeLayout layout2(tree2.args.max_depth, tree2.args.tile_height, tree2.args.partition_color);
+        ScreenedArgs screened_args(0, 0, 0, 0, tree1.args.end_idx, layout1, layout2, screen_tolerance);
+        TaskLauncher product_launcher(INNER_PRODUCT_SCREENED_INTER_TASK_ID, TaskArgument(&screened_args, sizeof(ScreenedArgs)));
+        product_launcher.add_region_requirement(RegionRequirement(tree1.lr, READ_ONLY, EXCLUSIVE, tree1.lr));
+        product_launcher.add_region_requirement(RegionRequirement(tree2.lr, READ_ONLY, EXCLUSIVE, tree2.lr));
+        product_launcher.add_field(0, tree1.field, false);
+        product_launcher.add_field(1, tree2.field, false);
+        results.push_back(ScriptResult("inner_approx "+names[0]+" "+names[1], execute_resident(ctx, runtime, product_launcher), false, true));
+    }
+    else if( op == "gaxpy" || op == "multiply" ){
+        if( trees.count(names[0]) ){
+            *errors<<where<<": tree "<<names[0]<<" already exists"<<endl;
+            return;
+        }
+        ScriptTree &tree1 = trees.find(names[1])->second;
+        ScriptTree &tree2 = trees.find(names[2])->second;
+        int max_depth = max(tree1.args.max_depth, tree2.args.max_depth);
+        LogicalRegion lr = create_tree_region(ctx, runtime, max_depth);
+        Arguments args(0, 0, 0, max_depth, 0, (1LL<<max_depth)-1, next_color, 0, tree1.args.tile_height);
+        next_color += 10;
+        args.serial_cutoff = tree1.args.serial_cutoff;
+        TreeLayout layout1(tree1.args.max_depth, tree1.args.tile_height, tree1.args.partition_color);
+        TreeLayout layout2(tree2.args.max_depth, tree2.args.tile_height, tree2.args.partition_color);
+        TreeLayout layout3(max_depth, args.tile_height, args.partition_color);
+        MixedArgs mixed_args(0, 0, 0, 0, args.end_idx, layout1, layout2, layout3);
+        mixed_args.multiply = op == "multiply";
+        mixed_args.serial_cutoff = args.serial_cutoff;
+        TaskLauncher gaxpy_launcher(GAXPY_MIXED_INTER_TASK_ID, TaskArgument(&mixed_args, sizeof(MixedArgs)));
+        gaxpy_launcher.add_region_requirement(RegionRequirement(tree1.lr, READ_ONLY, EXCLUSIVE, tree1.lr));
+        gaxpy_launcher.add_region_requirement(RegionRequirement(tree2.lr, READ_ONLY, EXCLUSIVE, tree2.lr));
+        gaxpy_launcher.add_region_requirement(RegionRequirement(lr, WRITE_DISCARD, EXCLUSIVE, lr));
+        gaxpy_launcher.add_field(0, tree1.field, false);
+        gaxpy_launcher.add_field(1, tree2.field, false);
+        gaxpy_launcher.add_field(2, FID_X, false);
+        execute_resident(ctx, runtime, gaxpy_launcher);
+        add_tree(names[0], lr, args);
+    }
+    else if( op == "accumulate" ){
+        // Every source is its own producer reducing into one region, so they
+        // run concurrently instead of as a chain of gaxpys. A source leaf the
+        // sum refines stays where it is; the reconstruct afterwards carries
+        // it down halving per level, which is the pass gaxpy would apply.
+        if( trees.count(names[0]) ){
+            *errors<<where<<": tree "<<names[0]<<" already exists"<<endl;
+            return;
+        }
+        int max_depth = 0;
+        for( size_t i = 1 ; i < names.size() ; i++ )
+            max_depth = max(max_depth, trees.find(names[i])->second.args.max_depth);
+        LogicalRegion lr = create_tree_region(ctx, runtime, max_depth);
+        Arguments args(0, 0, 0, max_depth, 0, (1LL<<max_depth)-1, next_color, 0, trees.find(names[1])->second.args.tile_height);
+        next_color += 10;
+        args.serial_cutoff = serial_cutoff;
+        TreeLayout layout2(max_depth, args.tile_height, args.partition_color);
+        runtime->fill_field<TreeArgs>(ctx, lr, lr, FID_X, TreeSumReduction::identity);
+        for( size_t i = 1 ; i < names.size() ; i++ ){
+            ScriptTree &source = trees.find(names[i])->second;
+            TreeLayout layout1(source.args.max_depth, source.args.tile_height, source.args.partition_color);
+            MixedArgs mixed_args(0, 0, 0, 0, source.args.end_idx, layout1, layout2);
+            TaskLauncher accumulate_launcher(ACCUMULATE_INTER_TASK_ID, TaskArgument(&mixed_args, sizeof(MixedArgs)));
+            accumulate_launcher.add_region_requirement(RegionRequirement(source.lr, READ_ONLY, EXCLUSIVE, source.lr));
+            accumulate_launcher.add_region_requirement(RegionRequirement(lr, TREE_SUM_REDOP_ID, EXCLUSIVE, lr));
+            accumulate_launcher.add_field(0, source.field, false);
+            accumulate_launcher.add_field(1, FID_X, false);
+            execute_resident(ctx, runtime, accumulate_launcher);
+        }
+        TaskLauncher partition_launcher(PARTITION_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        partition_launcher.add_region_requirement(RegionRequirement(lr, READ_ONLY, EXCLUSIVE, lr));
+        partition_launcher.add_field(0, FID_X, false);
+        execute_resident(ctx, runtime, partition_launcher);
+        TaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+        reconstruct_launcher.add_region_requirement(RegionRequirement(lr, READ_WRITE, EXCLUSIVE, lr));
+        reconstruct_launcher.add_field(0, FID_X, false);
+        execute_resident(ctx, runtime, reconstruct_launcher);
+        add_tree(names[0], lr, args);
+    }
+    else if( op == "diff" ){
+        if( trees.count(names[0]) ){
+            *errors<<where<<": tree "<<names[0]<<" already exists"<<endl;
+            return;
+        }
+        ScriptTree &source = trees.find(names[1])->second;
+        LogicalRegion lr = create_tree_region(ctx, runtime, source.args.max_depth);
+        Arguments args(0, 0, 0, source.args.max_depth, 0, source.args.end_idx, next_color, 0, source.args.tile_height);
+        next_color += 10;
+        DiffArgs diff_args(0, 0, 0, args.end_idx, TreeLayout(args.max_depth, args.tile_height, args.partition_color));
+        TaskLauncher diff_launcher(DIFFERENTIATE_INTER_TASK_ID, TaskArgument(&diff_args, sizeof(DiffArgs)));
+        RegionRequirement input_req(source.lr, READ_ONLY, EXCLUSIVE, source.lr);
+        input_req.add_field(source.field, false);
+        diff_launcher.add_region_requirement(input_req);
+        diff_launcher.add_region_requirement(RegionRequirement(lr, WRITE_DISCARD, EXCLUSIVE, lr));
+        diff_launcher.add_field(1, FID_X, false);
+        execute_resident(ctx, runtime, diff_launcher);
+        add_tree(names[0], lr, args);
+    }
+    else if( op == "apply" ){
+        if( trees.count(names[0]) ){
+            *errors<<where<<": tree "<<names[0]<<" already exists"<<endl;
+            return;
+        }
+        ScriptTree &source = trees.find(names[1])->second;
+        if( !source.compressed ){
+            *errors<<where<<": apply needs "<<names[1]<<" compressed"<<endl;
+            return;
+        }
+        LogicalRegion lr = create_tree_region(ctx, runtime, source.args.max_depth);
+        Arguments args(0, 0, 0, source.args.max_depth, 0, source.args.end_idx, next_color, 0, source.args.tile_height);
+        next_color += 10;
+        ApplyArgs apply_args(0, 0, 0, args.end_idx, TreeLayout(args.max_depth, args.tile_height, args.partition_color), tolerance);
+        vector<char> buffer = pack_apply_args(apply_args, vector<ApplySource>(1, ApplySource(0, 0)));
+        TaskLauncher apply_launcher(APPLY_INTER_TASK_ID, TaskArgument(&buffer[0], buffer.size()));
+        RegionRequirement input_req(source.lr, READ_ONLY, EXCLUSIVE, source.lr);
+        input_req.add_field(source.field, false);
+        apply_launcher.add_region_requirement(input_req);
+        apply_launcher.add_region_requirement(RegionRequirement(lr, WRITE_DISCARD, EXCLUSIVE, lr));
+        apply_launcher.add_field(1, FID_X, false);
+        execute_resident(ctx, runtime, apply_launcher);
+        add_tree(names[0], lr, args);
+        trees.find(names[0])->second.compressed = true;
+    }
+    else if( op == "snapshot" ){
+        if( trees.count(names[0]) ){
+            *errors<<where<<": tree "<<names[0]<<" already exists"<<endl;
+            return;
+        }
+        ScriptTree &source = trees.find(names[1])->second;
+        trees.insert(make_pair(names[0], source));
+        region_users[source.lr]++;
+        data_users[make_pair(source.lr, source.field)]++;
+    }
+    else if( op == "drop" ){
+        release(trees.find(names[0])->second);
+        trees.erase(names[0]);
+    }
+    else{
+        *errors<<where<<": unknown operation "<<op<<endl;
+        return;
+    }
+    report_operation(ctx, runtime, resource_report, line);
+}
+
+// Formats and forgets the results whose futures have resolved, or all of
+// them (waiting as needed) when ready_only is false. A check that does not
+// hold is marked FAILED on its line and counted in failed_checks.
+string collect_results( vector<ScriptResult> &results, bool ready_only, int *failed_checks=NULL ){
+    ostringstream out;
+    vector<ScriptResult> pending;
+    for( size_t i = 0 ; i < results.size() ; i++ ){
+        if( ready_only && ( !results[i].result.is_ready() || ( results[i].has_reference && !results[i].reference.is_ready() ) ) ){
+            pending.push_back(results[i]);
+            continue;
+        }
+        string failure;
+        if( results[i].has_reference ){
+            // Norms are compared before the square root, so equal means equal.
+            int value = results[i].result.get_result<int>();
+            int reference = results[i].reference.get_result<int>();
+            if( value != reference ){
+                ostringstream expected;
+                expected<<" FAILED: expected ";
+                if( results[i].is_norm )
+                    expected<<sqrt(reference);
+                else
+                    expected<<reference;
+                failure = expected.str();
+            }
+        }
+        if( results[i].is_norm )
+            out<<results[i].label<<" = "<<sqrt(results[i].result.get_result<int>());
+        else if( results[i].is_estimate ){
+            InnerProductEstimate estimate = results[i].result.get_result<InnerProductEstimate>();
+            out<<results[i].label<<" = "<<estimate.estimate<<" +/- "<<estimate.error_bound;
+        }
+        else if( results[i].is_same ){
+            int same = results[i].result.get_result<int>();
+            string answer = same < 0 ? "unknown" : same ? "yes" : "no";
+            out<<results[i].label<<" = "<<answer;
+            if( !results[i].expected.empty() && answer != results[i].expected )
+                failure = " FAILED: expected "+results[i].expected;
+        }
+        else
+            out<<results[i].label<<" = "<<results[i].result.get_result<int>();
+        out<<failure<<endl;
+        if( !failure.empty() && failed_checks != NULL )
+            (*failed_checks)++;
+    }
+    results.swap(pending);
+    return out.str();
+}
+
+string ScriptSession::collect( bool ready_only ){
+    return collect_results(results, ready_only, &failed_checks);
+}
+
+void ScriptSession::close(){
+    for( map<string,ScriptTree>::iterator it = trees.begin() ; it != trees.end() ; ++it )
+        release(it->second);
+    trees.clear();
+}
+
+void run_script( const char *filename, int tile_height, coord_t serial_cutoff, bool resource_report, Context ctx, HighLevelRuntime *runtime ){
+    ifstream script(filename);
+    if( !script ){
+        cerr<<"Unable to open script "<<filename<<endl;
+        return;
+    }
+    ScriptSession session(ctx, runtime, tile_height, serial_cutoff, resource_report);
+    string line;
+    int line_no = 0;
+    while( getline(script, line) ){
+        line_no++;
+        ostringstream where;
+        where<<filename<<":"<<line_no;
+        session.execute(line, where.str());
+    }
+    cout<<session.collect(false);
+    if( session.failed_checks > 0 )
+        cerr<<filename<<": "<<session.failed_checks<<" check(s) failed"<<endl;
+    session.close();
+}
+
+// Socket writes pass MSG_NOSIGNAL, so a client that hangs up early costs an
+// EPIPE instead of a SIGPIPE for the whole process; stdout falls back to write.
+void write_all( int fd, const string &text ){
+    size_t written = 0;
+    while( written < text.size() ){
+        ssize_t count = send(fd, text.data()+written, text.size()-written, MSG_NOSIGNAL);
+        if( count < 0 && errno == ENOTSOCK )
+            count = write(fd, text.data()+written, text.size()-written);
+        if( count <= 0 )
+            return;
+        written += count;
+    }
+}
+
+// A line a client sent, or with closed set, the end of its input.
+struct ServiceCommand{
+    int client;
+    string line;
+    bool closed;
+};
+
+// Service mode does its socket I/O on threads of its own: one accepts clients
+// and one per client splits its input into lines. The lines queue up here for
+// the top-level task, which waits on wake instead of blocking its processor in
+// accept or read. wake is also triggered by a SERVICE_WAKE_TASK_ID launch once
+// a result is ready, so the task wakes for whichever comes first. Writing to
+// stop_pipe ends every reader, stdin's included, so all of them can be joined.
+struct ServiceQueue{
+    mutex lock;
+    deque<ServiceCommand> commands;
+    vector<thread> threads;
+    map<int,int> inputs;
+    int clients;
+    bool stopping;
+    int stop_pipe[2];
+    Realm::UserEvent wake;
+    bool woken;
+    ServiceQueue() : clients(0), stopping(false), woken(true) { stop_pipe[0] = stop_pipe[1] = -1; }
+    void push( int client, const string &line, bool closed ){
+        lock_guard<mutex> guard(lock);
+        ServiceCommand command = { client, line, closed };
+        commands.push_back(command);
+        notify_locked();
+    }
+    void notify(){
+        lock_guard<mutex> guard(lock);
+        notify_locked();
+    }
+    // Moves the queued commands into taken and returns the event to wait on
+    // if there were none.
+    Realm::UserEvent take( deque<ServiceCommand> &taken ){
+        lock_guard<mutex> guard(lock);
+        if( woken ){
+            wake = Realm::UserEvent::create_user_event();
+            woken = false;
+        }
+        taken.swap(commands);
+        return wake;
+    }
+private:
+    void notify_locked(){
+        if( woken )
+            return;
+        woken = true;
+        wake.trigger();
+    }
+};
+
+// The wake tasks of a finished service can still run, so the queue outlives it.
+static ServiceQueue service_queue;
+
+void service_wake_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    service_queue.notify();
+}
+
+// Splits a client's input into lines. A last line without a newline still
+// counts; end of input, a shutdown of the socket or a stop of the service
+// closes the client.
+void read_client( int client, int fd ){
+    string pending;
+    char buffer[4096];
+    while( true ){
+        struct pollfd inputs[2];
+        inputs[0].fd = fd;
+        inputs[1].fd = service_queue.stop_pipe[0];
+        inputs[0].events = inputs[1].events = POLLIN;
+        inputs[0].revents = inputs[1].revents = 0;
+        if( poll(inputs, 2, -1) < 0 ){
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+        if( inputs[1].revents != 0 )
+            break;
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if( count < 0 && errno == EINTR )
+            continue;
+        if( count <= 0 )
+            break;
+        pending.append(buffer, count);
+        size_t end;
+        while( ( end = pending.find('\n') ) != string::npos ){
+            service_queue.push(client, pending.substr(0, end), false);
+            pending.erase(0, end+1);
+        }
+    }
+    if( !pending.empty() )
+        service_queue.push(client, pending, false);
+    service_queue.push(client, "", true);
+}
+
+void add_client( int fd ){
+    lock_guard<mutex> guard(service_queue.lock);
+    if( service_queue.stopping ){
+        ::close(fd);
+        return;
+    }
+    int client = ++service_queue.clients;
+    service_queue.inputs[client] = fd;
+    service_queue.threads.push_back(thread(read_client, client, fd));
+}
+
+void accept_clients( int listener ){
+    while( true ){
+        int fd = accept(listener, NULL, NULL);
+        if( fd < 0 && errno == EINTR )
+            continue;
+        if( fd < 0 )
+            return;
+        add_client(fd);
+    }
+}
+
+// Stops accepting and ends every client's input, so the readers finish.
+void stop_service( int listener ){
+    lock_guard<mutex> guard(service_queue.lock);
+    if( service_queue.stopping )
+        return;
+    service_queue.stopping = true;
+    if( listener >= 0 )
+        shutdown(listener, SHUT_RDWR);
+    char stop = 0;
+    if( write(service_queue.stop_pipe[1], &stop, 1) != 1 )
+        cerr<<"Unable to stop the service readers: "<<strerror(errno)<<endl;
+}
+
+// A connected client's results, written back in request order as their
+// futures resolve.
+struct ServiceClient{
+    int out_fd;
+    int err_fd;
+    int requests;
+    bool quit;
+    vector<ScriptResult> results;
+};
+
+// Service mode: keeps the runtime and every tree built so far alive between
+// requests. With no socket path it serves stdin/stdout; otherwise it serves
+// any number of local clients at once on a Unix socket, all sharing the same
+// trees. Requests are issued as they arrive and not waited on, so requests
+// that touch different trees run concurrently; Legion orders the ones that
+// share a tree. A bad request is reported to the client that sent it. "quit"
+// ends a client and "shutdown" the whole service.
+void run_service( const char *socket_path, int tile_height, coord_t serial_cutoff, bool resource_report, Context ctx, HighLevelRuntime *runtime ){
+    ScriptSession session(ctx, runtime, tile_height, serial_cutoff, resource_report);
+    int listener = -1;
+    thread acceptor;
+    map<int,ServiceClient> clients;
+    if( pipe(service_queue.stop_pipe) != 0 ){
+        cerr<<"Unable to start the service: "<<strerror(errno)<<endl;
+        return;
+    }
+    if( socket_path == NULL ){
+        ServiceClient stdin_client = { STDOUT_FILENO, STDERR_FILENO, 0, false, vector<ScriptResult>() };
+        lock_guard<mutex> guard(service_queue.lock);
+        clients[++service_queue.clients] = stdin_client;
+        service_queue.threads.push_back(thread(read_client, service_queue.clients, STDIN_FILENO));
+    }
+    else{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if( strlen(socket_path) >= sizeof(address.sun_path) ){
+            cerr<<"Socket path "<<socket_path<<" is too long"<<endl;
+            ::close(service_queue.stop_pipe[0]);
+            ::close(service_queue.stop_pipe[1]);
+            return;
+        }
+        strcpy(address.sun_path, socket_path);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socket_path);
+        if( listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 4) != 0 ){
+            cerr<<"Unable to listen on "<<socket_path<<": "<<strerror(errno)<<endl;
+            if( listener >= 0 )
+                ::close(listener);
+            ::close(service_queue.stop_pipe[0]);
+            ::close(service_queue.stop_pipe[1]);
+            return;
+        }
+        cout<<"Serving on "<<socket_path<<endl;
+        acceptor = thread(accept_clients, listener);
+    }
+    bool running = true;
+    while( running || !clients.empty() ){
+        deque<ServiceCommand> commands;
+        Realm::UserEvent wake = service_queue.take(commands);
+        for( size_t i = 0 ; i < commands.size() ; i++ ){
+            const ServiceCommand &command = commands[i];
+            if( !clients.count(command.client) ){
+                lock_guard<mutex> guard(service_queue.lock);
+                int fd = service_queue.inputs[command.client];
+                ServiceClient socket_client = { fd, fd, 0, false, vector<ScriptResult>() };
+                clients[command.client] = socket_client;
+            }
+            ServiceClient &client = clients[command.client];
+            if( command.closed ){
+                write_all(client.out_fd, collect_results(client.results, false));
+                if( listener >= 0 ){
+                    lock_guard<mutex> guard(service_queue.lock);
+                    service_queue.inputs.erase(command.client);
+                    ::close(client.out_fd);
+                }
+                clients.erase(command.client);
+                if( listener < 0 )
+                    running = false;
+                continue;
+            }
+            if( client.quit )
+                continue;
+            client.requests++;
+            if( command.line == "quit" || command.line == "shutdown" ){
+                client.quit = true;
+                if( command.line == "shutdown" || listener < 0 ){
+                    running = false;
+                    stop_service(listener);
+                }
+                else
+                    shutdown(client.out_fd, SHUT_RD);
+                if( listener < 0 )
+                    commands.push_back(ServiceCommand{ command.client, "", true });
+                continue;
+            }
+            ostringstream where, errors;
+            where<<( listener < 0 ? string("stdin") : "client "+to_string(command.client) )<<" request "<<client.requests;
+            session.errors = &errors;
+            size_t issued = session.results.size();
+            session.execute(command.line, where.str());
+            session.errors = &cerr;
+            write_all(client.err_fd, errors.str());
+            for( size_t r = issued ; r < session.results.size() ; r++ ){
+                TaskLauncher wake_launcher(SERVICE_WAKE_TASK_ID, TaskArgument(NULL, 0));
+                wake_launcher.add_future(session.results[r].result);
+                runtime->execute_task(ctx, wake_launcher);
+                client.results.push_back(session.results[r]);
+            }
+            session.results.clear();
+        }
+        for( map<int,ServiceClient>::iterator it = clients.begin() ; it != clients.end() ; ++it )
+            write_all(it->second.out_fd, collect_results(it->second.results, true));
+        if( commands.empty() )
+            wake.wait();
+    }
+    stop_service(listener);
+    if( listener >= 0 )
+        acceptor.join();
+    for( size_t i = 0 ; i < service_queue.threads.size() ; i++ )
+        service_queue.threads[i].join();
+    if( listener >= 0 ){
+        // Clients that connected but never got a request in.
+        for( map<int,int>::iterator it = service_queue.inputs.begin() ; it != service_queue.inputs.end() ; ++it )
+            ::close(it->second);
+        ::close(listener);
+        unlink(socket_path);
+    }
+    ::close(service_queue.stop_pipe[0]);
+    ::close(service_queue.stop_pipe[1]);
+    session.close();
+}
+
+// Exercises the hashed node store on its own: two random trees go through
+// refine, norm, inner product, gaxpy, compress and reconstruct. The store is
+// not an Arguments tree, so scripts, the service and the ensemble driver keep
+// the tile layout; -hashed selects this driver only.
+void run_hashed( int max_depth, int shard_level, int shards, coord_t capacity, Context ctx, HighLevelRuntime *runtime ){
+    if( max_depth > 62 ){
+        cerr<<"Hashed store keys hold at most 62 levels, clamping max_depth"<<endl;
+        max_depth = 62;
+    }
+    HashLayout layout1(max_depth, shard_level, shards, capacity, 10);
+    HashLayout layout2(max_depth, shard_level, shards, capacity, 20);
+    HashLayout layout3(max_depth, shard_level, shards, capacity, 30);
+    LogicalRegion lr1 = create_hash_store(ctx, runtime, layout1);
+    LogicalRegion lr2 = create_hash_store(ctx, runtime, layout2);
+    LogicalRegion lr3 = create_hash_store(ctx, runtime, layout3);
+    HashArgs args1(layout1), args2(layout2);
+    args1.gen = rand();
+    args2.gen = rand();
+    HashArgs pair_args(layout1, layout2, layout3);
+
+    cout<<"Launching Hashed Refine Tasks"<<endl;
+    TaskLauncher refine_launcher(HASH_REFINE_TASK_ID, TaskArgument(&args1, sizeof(HashArgs)));
+    refine_launcher.add_region_requirement(hash_requirement(lr1, READ_WRITE, lr1));
+    execute_resident(ctx, runtime, refine_launcher);
+    TaskLauncher refine_launcher2(HASH_REFINE_TASK_ID, TaskArgument(&args2, sizeof(HashArgs)));
+    refine_launcher2.add_region_requirement(hash_requirement(lr2, READ_WRITE, lr2));
+    execute_resident(ctx, runtime, refine_launcher2);
+
+    TaskLauncher print_launcher(HASH_PRINT_TASK_ID, TaskArgument(&args1, sizeof(HashArgs)));
+    print_launcher.add_region_requirement(hash_requirement(lr1, READ_ONLY, lr1));
+    execute_resident(ctx, runtime, print_launcher);
+
+    TaskLauncher norm_launcher(HASH_NORM_TASK_ID, TaskArgument(&args1, sizeof(HashArgs)));
+    norm_launcher.add_region_requirement(hash_requirement(lr1, READ_ONLY, lr1));
+    Future norm = execute_resident(ctx, runtime, norm_launcher);
+
+    TaskLauncher product_launcher(HASH_INNER_PRODUCT_TASK_ID, TaskArgument(&pair_args, sizeof(HashArgs)));
+    product_launcher.add_region_requirement(hash_requirement(lr1, READ_ONLY, lr1));
+    product_launcher.add_region_requirement(hash_requirement(lr2, READ_ONLY, lr2));
+    Future product = execute_resident(ctx, runtime, product_launcher);
+
+    TaskLauncher gaxpy_launcher(HASH_GAXPY_TASK_ID, TaskArgument(&pair_args, sizeof(HashArgs)));
+    gaxpy_launcher.add_region_requirement(hash_requirement(lr1, READ_ONLY, lr1));
+    gaxpy_launcher.add_region_requirement(hash_requirement(lr2, READ_ONLY, lr2));
+    gaxpy_launcher.add_region_requirement(hash_requirement(lr3, READ_WRITE, lr3));
+    execute_resident(ctx, runtime, gaxpy_launcher);
+
+    HashArgs args3(layout3);
+    TaskLauncher gaxpy_norm_launcher(HASH_NORM_TASK_ID, TaskArgument(&args3, sizeof(HashArgs)));
+    gaxpy_norm_launcher.add_region_requirement(hash_requirement(lr3, READ_ONLY, lr3));
+    Future gaxpy_norm = execute_resident(ctx, runtime, gaxpy_norm_launcher);
+
+    TaskLauncher compress_launcher(HASH_COMPRESS_TASK_ID, TaskArgument(&args1, sizeof(HashArgs)));
+    compress_launcher.add_region_requirement(hash_requirement(lr1, READ_WRITE, lr1));
+    execute_resident(ctx, runtime, compress_launcher);
+    TaskLauncher reconstruct_launcher(HASH_RECONSTRUCT_TASK_ID, TaskArgument(&args1, sizeof(HashArgs)));
+    reconstruct_launcher.add_region_requirement(hash_requirement(lr1, READ_WRITE, lr1));
+    execute_resident(ctx, runtime, reconstruct_launcher);
+    execute_resident(ctx, runtime, print_launcher);
+
+    cout<<"norm lr1 = "<<sqrt(norm.get_result<int>())<<endl;
+    cout<<"inner lr1 lr2 = "<<product.get_result<int>()<<endl;
+    cout<<"norm gaxpy = "<<sqrt(gaxpy_norm.get_result<int>())<<endl;
+    destroy_tree_region(ctx, runtime, lr1);
+    destroy_tree_region(ctx, runtime, lr2);
+    destroy_tree_region(ctx, runtime, lr3);
+}
+
+// Defined with the kernels it runs.
+void run_reference( int max_depth, int tile_height, int truncate_tol, int second_max_depth, int second_tile_height, int function, double refine_tolerance );
+
+// Ensemble mode: count trees of one depth stored back to back in a single
+// region, tree k in slot [k*stride, (k+1)*stride). Each operation is one
+// index launch over the per-tree partition, so the runtime analyses and
+// distributes one launch for the whole set rather than one per tree. Inside
+// its slot every tree is laid out exactly like a standalone tree.
+#define ENSEMBLE_PARTITION_COLOR 1
+
+struct Ensemble{
+    LogicalRegion lr;
+    LogicalPartition slots;
+    int count;
+    coord_t stride;
+    Arguments args;
+    Ensemble( LogicalRegion _lr, LogicalPartition _slots, int _count, Arguments _args ) : lr(_lr), slots(_slots), count(_count), stride(1LL<<_args.max_depth), args(_args) {}
+    Rect<1> domain() const { return Rect<1>(0, count-1); }
+    Arguments tree_args( int k ) const {
+        Arguments tree = args;
+        tree.idx = k*stride;
+        tree.end_idx = k*stride + stride-1;
+        return tree;
+    }
+    TreeLayout layout( int k ) const { return TreeLayout(args.max_depth, args.tile_height, args.partition_color, k*stride); }
+};
+
+Ensemble create_ensemble( Context ctx, HighLevelRuntime *runtime, int count, Arguments args ){
+    coord_t stride = 1LL<<args.max_depth;
+    LogicalRegion lr = create_tree_region(ctx, runtime, Rect<1>(0, count*stride-1));
+    IndexSpace is = lr.get_index_space();
+    DomainPointColoring coloring;
+    for( int k = 0 ; k < count ; k++ )
+        coloring[k] = Rect<1>(k*stride, k*stride+stride-1);
+    IndexPartition ip = runtime->create_index_partition(ctx, is, Rect<1>(0, count-1), coloring, DISJOINT_KIND, ENSEMBLE_PARTITION_COLOR);
+    return Ensemble(lr, runtime->get_logical_partition(ctx, lr, ip), count, args);
+}
+
+void destroy_ensemble( Context ctx, HighLevelRuntime *runtime, const Ensemble &ensemble ){
+    destroy_tree_region(ctx, runtime, ensemble.lr);
+}
+
+// Launches task_id once per tree with that tree's Arguments.
+FutureMap ensemble_launch( Context ctx, HighLevelRuntime *runtime, const Ensemble &ensemble, TaskID task_id, PrivilegeMode mode, bool refine ){
+    ArgumentMap arg_map;
+    vector<Arguments> tree_args;
+    for( int k = 0 ; k < ensemble.count ; k++ ){
+        tree_args.push_back(ensemble.tree_args(k));
+        if( refine )
+            tree_args[k].gen = rand();
+    }
+    for( int k = 0 ; k < ensemble.count ; k++ )
+        arg_map.set_point(k, TaskArgument(&tree_args[k], sizeof(Arguments)));
+    IndexTaskLauncher launcher(task_id, ensemble.domain(), TaskArgument(NULL, 0), arg_map);
+    launcher.add_region_requirement(RegionRequirement(ensemble.slots, 0, mode, EXCLUSIVE, ensemble.lr));
+    launcher.add_field(0, FID_X, false);
+    return execute_resident(ctx, runtime, launcher);
+}
+
+// out[k] = a[k] + b[k] for every k, as one launch of the mixed-layout gaxpy.
+void ensemble_gaxpy( Context ctx, HighLevelRuntime *runtime, const Ensemble &a, const Ensemble &b, const Ensemble &out ){
+    ArgumentMap arg_map;
+    vector<MixedArgs> tree_args;
+    for( int k = 0 ; k < out.count ; k++ ){
+        Arguments root = out.tree_args(k);
+        tree_args.push_back(MixedArgs(0, 0, 0, root.idx, root.end_idx, a.layout(k), b.layout(k), out.layout(k)));
+    }
+    for( int k = 0 ; k < out.count ; k++ )
+        arg_map.set_point(k, TaskArgument(&tree_args[k], sizeof(MixedArgs)));
+    IndexTaskLauncher launcher(GAXPY_MIXED_INTER_TASK_ID, out.domain(), TaskArgument(NULL, 0), arg_map);
+    launcher.add_region_requirement(RegionRequirement(a.slots, 0, READ_ONLY, EXCLUSIVE, a.lr));
+    launcher.add_region_requirement(RegionRequirement(b.slots, 0, READ_ONLY, EXCLUSIVE, b.lr));
+    launcher.add_region_requirement(RegionRequirement(out.slots, 0, WRITE_DISCARD, EXCLUSIVE, out.lr));
+    launcher.add_field(0, FID_X, false);
+    launcher.add_field(1, FID_X, false);
+    launcher.add_field(2, FID_X, false);
+    execute_resident(ctx, runtime, launcher);
+}
+
+void print_ensemble_norms( const string &label, const Ensemble &ensemble, FutureMap norms ){
+    for( int k = 0 ; k < ensemble.count ; k++ )
+        cout<<"norm "<<label<<"["<<k<<"] = "<<sqrt(norms.get_result<int>(k))<<endl;
+}
+
+void run_ensemble( int count, Arguments args, bool resource_report, Context ctx, HighLevelRuntime *runtime ){
+    Arguments args_b = args;
+    args_b.partition_color += 10;
+    Arguments args_c = args;
+    args_c.partition_color += 20;
+    Ensemble a = create_ensemble(ctx, runtime, count, args);
+    Ensemble b = create_ensemble(ctx, runtime, count, args_b);
+    Ensemble c = create_ensemble(ctx, runtime, count, args_c);
+    ensemble_launch(ctx, runtime, a, REFINE_INTER_TASK_ID, WRITE_DISCARD, true);
+    ensemble_launch(ctx, runtime, b, REFINE_INTER_TASK_ID, WRITE_DISCARD, true);
+    report_operation(ctx, runtime, resource_report, "ensemble refine");
+    FutureMap norm_a = ensemble_launch(ctx, runtime, a, NORM_INTER_TASK_ID, READ_ONLY, false);
+    ensemble_gaxpy(ctx, runtime, a, b, c);
+    report_operation(ctx, runtime, resource_report, "ensemble gaxpy");
+    FutureMap norm_c = ensemble_launch(ctx, runtime, c, NORM_INTER_TASK_ID, READ_ONLY, false);
+    ensemble_launch(ctx, runtime, a, COMPRESS_INTER_TASK_ID, READ_WRITE, false);
+    report_operation(ctx, runtime, resource_report, "ensemble compress");
+    print_ensemble_norms("a", a, norm_a);
+    print_ensemble_norms("a+b", c, norm_c);
+    destroy_ensemble(ctx, runtime, a);
+    destroy_ensemble(ctx, runtime, b);
+    destroy_ensemble(ctx, runtime, c);
+}
+
+void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime) {
+
+    int overall_max_depth = 7;
+    int actual_left_depth = 0;
+    int tile_height = 3;
+    int truncate_tol = 0;
+    int second_max_depth = 0;
+    int second_tile_height = 0;
+    const char *script_file = NULL;
+    int ensemble = 0;
+    bool service = false;
+    const char *socket_path = NULL;
+    bool hashed = false;
+    int shard_level = 4;
+    int shards = 8;
+    coord_t hash_capacity = 1<<16;
+    coord_t serial_cutoff = 0;
+    bool resource_report = false;
+    bool reference = false;
+    int function = 0;
+    double refine_tolerance = 1e-3;
+
+    long int seed = 12345;
+    {
+        const InputArgs &command_args = HighLevelRuntime::get_input_args();
+        for (int idx = 1; idx < command_args.argc; ++idx)
+        {
+            if (strcmp(command_args.argv[idx], "-max_depth") == 0)
+                overall_max_depth = atoi(command_args.argv[++idx]);
+            else if (strcmp(command_args.argv[idx], "-seed") == 0)
+                seed = atol(command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"--tile") == 0)
+                tile_height = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-truncate_tol") == 0)
+                truncate_tol = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-max_depth2") == 0)
+                second_max_depth = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"--tile2") == 0)
+                second_tile_height = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-script") == 0)
+                script_file = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"-ensemble") == 0)
+                ensemble = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-serve") == 0)
+                service = true;
+            else if(strcmp(command_args.argv[idx],"-socket") == 0)
+                socket_path = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"-hashed") == 0)
+                hashed = true;
+            else if(strcmp(command_args.argv[idx],"-shard_level") == 0)
+                shard_level = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-shards") == 0)
+                shards = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-hash_capacity") == 0)
+                hash_capacity = atoll( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-serial_cutoff") == 0)
+                serial_cutoff = atoll( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-resource_report") == 0)
+                resource_report = true;
+            else if(strcmp(command_args.argv[idx],"-spill_dir") == 0)
+                spill_directory = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"-reference") == 0)
+                reference = true;
+            else if(strcmp(command_args.argv[idx],"-function") == 0){
+                function = find_refine_function(command_args.argv[++idx]);
+                if( function < 0 ){
+                    cerr<<"Unknown function "<<command_args.argv[idx]<<", refining randomly"<<endl;
+                    function = 0;
+                }
+            }
+            else if(strcmp(command_args.argv[idx],"-refine_tol") == 0)
+                refine_tolerance = atof( command_args.argv[++idx]);
+        }
+    }
+    if( hashed && (service || script_file != NULL || reference) ){
+        cerr<<"-hashed runs its own driver and cannot be combined with -script, -service or -reference"<<endl;
+        return;
+    }
+    if( second_max_depth == 0 )
+        second_max_depth = overall_max_depth;
+    if( second_tile_height == 0 )
+        second_tile_height = tile_height;
+    srand(seed);
+    last_report_time = wall_seconds();
+    if( reference ){
+        run_reference(overall_max_depth, tile_height, truncate_tol, second_max_depth, second_tile_height, function, refine_tolerance);
+        return;
+    }
+    if( service ){
+        run_service(socket_path, tile_height, serial_cutoff, resource_report, ctx, runtime);
+        return;
+    }
+    if( script_file != NULL ){
+        run_script(script_file, tile_height, serial_cutoff, resource_report, ctx, runtime);
+        return;
+    }
+    if( hashed ){
+        run_hashed(overall_max_depth, min(shard_level, overall_max_depth), shards, hash_capacity, ctx, runtime);
+        return;
+    }
+    if( ensemble > 0 ){
+        Arguments args(0, 0, 0, overall_max_depth, 0, (1LL<<overall_max_depth)-1, 10, 0, tile_height);
+        args.serial_cutoff = serial_cutoff;
+        args.function = function;
+        args.refine_tolerance = refine_tolerance;
+        run_ensemble(ensemble, args, resource_report, ctx, runtime);
+        return;
+    }
+    LogicalRegion lr1 = create_tree_region(ctx, runtime, overall_max_depth);
+    Color partition_color1 = 10;
+    coord_t end_idx = (1<<overall_max_depth)-1;
+    Arguments args1(0, 0, 0, overall_max_depth, 0, end_idx, partition_color1, actual_left_depth, tile_height);
+    args1.gen = rand();
+    args1.serial_cutoff = serial_cutoff;
+    args1.prefetch = spill_directory != NULL;
+    args1.function = function;
+    args1.refine_tolerance = refine_tolerance;
+    cout<<"Launching Refine Task"<<endl;
+    TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
+    refine_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1));
+    refine_launcher.add_field(0, FID_X, false);
+    execute_resident(ctx, runtime, refine_launcher);
+    report_operation(ctx, runtime, resource_report, "refine");
+
+    cout<<"Launching Print Task After Refine"<<endl;
+    TaskLauncher print_launcher(PRINT_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
+    RegionRequirement req3( lr1 , READ_ONLY, EXCLUSIVE, lr1 );
+    req3.add_field(FID_X);
+    print_launcher.add_region_requirement( req3 );
+    execute_resident(ctx, runtime, print_launcher);
+
+    if( truncate_tol > 0 ){
+        cout<<"Launching Truncate Task"<<endl;
+        args1.tolerance = truncate_tol;
+        TaskLauncher truncate_launcher(TRUNCATE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
+        truncate_launcher.add_region_requirement(RegionRequirement(lr1, READ_WRITE, EXCLUSIVE, lr1));
+        truncate_launcher.add_field(0, FID_X, false);
+        execute_resident(ctx, runtime, truncate_launcher);
+        report_operation(ctx, runtime, resource_report, "truncate");
+        cout<<"Launching Print After Truncate"<<endl;
+        execute_resident(ctx, runtime, print_launcher);
+    }
+
+
+    cout<<"Creating 2nd Logical Region "<<second_max_depth<<endl;
+    LogicalRegion lr2 = create_tree_region(ctx, runtime, second_max_depth);
+    Color partition_color2 = 20;
+    coord_t end_idx2 = (1LL<<second_max_depth)-1;
+    Arguments args2(0, 0, 0,second_max_depth, 0, end_idx2, partition_color2, actual_left_depth, second_tile_height);
+    args2.gen=rand();
+    args2.serial_cutoff = serial_cutoff;
+    args2.prefetch = spill_directory != NULL;
+    args2.function = function;
+    args2.refine_tolerance = refine_tolerance;
+    TaskLauncher refine_launcher2(REFINE_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
+    refine_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2));
+    refine_launcher2.add_field(0, FID_X, false);
+    execute_resident(ctx, runtime, refine_launcher2);
+    report_operation(ctx, runtime, resource_report, "refine second tree");
+
+    TaskLauncher print_launcher2(PRINT_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
+    RegionRequirement req4( lr2 , READ_ONLY, EXCLUSIVE, lr2 );
+    req4.add_field(FID_X);
+    print_launcher2.add_region_requirement( req4 );
+    execute_resident(ctx, runtime, print_launcher2);
+    
+    cout<<"Launching Inner Product Task"<<endl;
+    InnerProductArgs args(0, 0, overall_max_depth, 0, end_idx, partition_color1, partition_color2, actual_left_depth, tile_height);
+    args.serial_cutoff = serial_cutoff;
+    args.prefetch = spill_directory != NULL;
+    TreeLayout layout1(overall_max_depth, tile_height, partition_color1);
+    TreeLayout layout2(second_max_depth, second_tile_height, partition_color2);
+    MixedArgs mixed_args(0, 0, 0, 0, end_idx, layout1, layout2);
+    TaskLauncher product_launcher(INNER_PRODUCT_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+    if( !(layout1 == layout2) )
+        product_launcher = TaskLauncher(INNER_PRODUCT_MIXED_INTER_TASK_ID, TaskArgument(&mixed_args, sizeof(MixedArgs)));
+    product_launcher.add_region_requirement(RegionRequirement(lr1, READ_ONLY, EXCLUSIVE, lr1));
+    product_launcher.add_region_requirement(RegionRequirement(lr2, READ_ONLY, EXCLUSIVE, lr2) );
+    product_launcher.add_field(0,FID_X, false);
+    product_launcher.add_field(1,FID_X, false);
+    Future result = execute_resident(ctx, runtime, product_launcher);
+    cout<<result.get_result<int>()<<endl;
+    report_operation(ctx, runtime, resource_report, "inner product");
+    destroy_tree_region(ctx, runtime, lr1);
+    destroy_tree_region(ctx, runtime, lr2);
+}
+
+
+void print_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctxt, HighLevelRuntime *runtime) {
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], tree_field(task, 0));
+    int node_counter=0;
+    int max_depth = args.max_depth;
+    queue<Arguments>tree;
+    tree.push(args);
+    int tile_height = args.tile_height;
+    while( !tree.empty() ){
+        Arguments temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t idx = temp.idx + l - 1 + (1<<(n%tile_height));
+        node_counter++;
+        cout<<node_counter<<": "<<n<<"~"<<read_acc[idx].lval<<"~"<<idx<<"~"<<read_acc[idx].value<<endl;
+        if(!read_acc[idx].is_leaf){
+            if((n%tile_height)==(tile_height-1)){
+                int tile_nodes = (1<<tile_height)-1;
+                coord_t sub_tree_size = (1<<(args.max_depth-n-1))-1;
+                coord_t start_idx = temp.idx+tile_nodes;
+                coord_t left_level = 2*l;
+                coord_t right_level = left_level+1;
+                coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
+                coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
+                Arguments for_left_sub_tree (n+1, 0, 0, max_depth, idx_left_sub_tree, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
+                Arguments for_right_sub_tree(n+1, 0, 0, max_depth, idx_right_sub_tree, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
+                tree.push( for_left_sub_tree );
+                tree.push( for_right_sub_tree );
+            }
+            else{
+                Arguments for_left_sub_tree (n+1, l * 2    , 0, max_depth, temp.idx, temp.idx, temp.partition_color, temp.actual_max_depth, temp.tile_height);
+                Arguments for_right_sub_tree(n+1, l * 2 + 1, 0, max_depth, temp.idx, temp.idx ,temp.partition_color, temp.actual_max_depth, temp.tile_height);
+                tree.push( for_left_sub_tree );
+                tree.push( for_right_sub_tree );
+            }
+        }
+    }
+}
+
+// Whether one function wants the node temp split, and the value the node
+// takes if it stays a leaf. tile_samples caches that function's samples of the
+// tile temp lies in.
+bool refine_decision( int function, long int gen, double refine_tolerance, const Arguments &temp, map<coord_t, vector<NodeSample> > &tile_samples, int &leaf_value ){
+    int n = temp.n;
+    int max_depth = temp.max_depth;
+    int tile_height = temp.tile_height;
+    BatchFunction f = refine_functions[function].eval;
+    if( f != NULL ){
+        int depth = n%tile_height;
+        if( !tile_samples.count(temp.idx) )
+            tile_samples[temp.idx] = sample_tile(f, n-depth, temp.actual_l>>depth, min(tile_height, max_depth-(n-depth)));
+        const NodeSample &sample = tile_samples[temp.idx][temp.l+(1<<depth)-1];
+        leaf_value = lround(FUNCTION_SCALE*sample.average);
+        return sample.error > refine_tolerance && n+1 < max_depth;
+    }
+    long int node_value = node_random(gen, n, temp.actual_l);
+    node_value = node_value % 10 + 1;
+    leaf_value = node_value % 3 + 1;
+    return node_value > 3 && n+1 < max_depth;
+}
+
+// Rehashes the subtree under one node bottom-up, and sets the heights on
+// the way. With child_roots the walk stays inside the tile: the child tiles'
+// roots are taken from child_roots in order, which is the order the inter
+// tasks launch them in.
+template<typename TREE_ACC>
+unsigned long long hash_subtree( const TREE_ACC &tree_acc, coord_t tile_start, int n, int l, int max_depth, int tile_height, const vector<TreeArgs> *child_roots=NULL, size_t *next_child=NULL ){
+    coord_t idx = tile_start + l + (1<<(n%tile_height))-1;
+    if( tree_acc[idx].is_leaf ){
+        tree_acc[idx].height = 0;
+        return tree_acc[idx].hash = node_hash(tree_acc[idx], 0, 0);
+    }
+    unsigned long long left, right;
+    int left_height, right_height;
+    if( (n % tile_height) == (tile_height-1) ){
+        if( child_roots != NULL ){
+            const TreeArgs &left_root = (*child_roots)[(*next_child)++];
+            const TreeArgs &right_root = (*child_roots)[(*next_child)++];
+            left = subtree_hash(left_root);
+            right = subtree_hash(right_root);
+            left_height = subtree_height(left_root);
+            right_height = subtree_height(right_root);
+        }
+        else{
+            coord_t left_start = child_tile_start(tile_start, tile_height, max_depth, n, l, 0);
+            coord_t right_start = child_tile_start(tile_start, tile_height, max_depth, n, l, 1);
+            left = hash_subtree(tree_acc, left_start, n+1, 0, max_depth, tile_height);
+            right = hash_subtree(tree_acc, right_start, n+1, 0, max_depth, tile_height);
+            left_height = subtree_height(tree_acc[left_start]);
+            right_height = subtree_height(tree_acc[right_start]);
+        }
+    }
+    else{
+        coord_t left_idx = tile_start + 2*l + (1<<((n+1)%tile_height))-1;
+        left = hash_subtree(tree_acc, tile_start, n+1, 2*l, max_depth, tile_height, child_roots, next_child);
+        right = hash_subtree(tree_acc, tile_start, n+1, 2*l+1, max_depth, tile_height, child_roots, next_child);
+        left_height = subtree_height(tree_acc[left_idx]);
+        right_height = subtree_height(tree_acc[left_idx+1]);
+    }
+    tree_acc[idx].height = parent_height(left_height, right_height);
+    return tree_acc[idx].hash = node_hash(tree_acc[idx], left, right);
+}
+
+template<typename TREE_ACC>
+void write_refined_node( const TREE_ACC &tree_acc, coord_t idx, coord_t actual_l, bool refine, int leaf_value ){
+    if ( !refine ) {
+        tree_acc[idx].value = leaf_value;
+        tree_acc[idx].is_leaf =true;
+        tree_acc[idx].lval = actual_l;
+        tree_acc[idx].norm = tree_acc[idx].value*tree_acc[idx].value;
+        tree_acc[idx].hash = node_hash(tree_acc[idx], 0, 0);
+    }
+    else {
+        tree_acc[idx].value = 0;
+        tree_acc[idx].is_leaf = false;
+        tree_acc[idx].lval = actual_l;
+        tree_acc[idx].norm = -1;
+        tree_acc[idx].hash = 0;
+    }
+}
+
+// Queues the children of refined node temp (at idx): the rest of its tile,
+// the next tile down in serial mode, or a launch entry for the inter task.
+void push_refine_children( const Arguments &args, const Arguments &temp, coord_t idx, queue<Arguments> &tree, vector<HelperArgs> &launch_entries ){
+    int n = temp.n;
+    int l = temp.l;
+    coord_t actual_l = temp.actual_l;
+    int max_depth = args.max_depth;
+    int tile_height = args.tile_height;
+    if( (n % tile_height )==( tile_height-1 ) ){
+        if( args.serial ){
+            for( int child = 0 ; child < 2 ; child++ ){
+                Arguments child_args(n+1, 0, 2*actual_l+child, max_depth, child_tile_start(temp.idx, tile_height, max_depth, n, l, child), 0, temp.partition_color, temp.actual_max_depth, tile_height);
+                tree.push( child_args );
+            }
+        }
+        else
+            launch_entries.push_back(HelperArgs(l, actual_l, idx, true, n));
+    }
+    else{
+        Arguments for_left_sub_tree (n+1, l * 2    ,2*actual_l, max_depth, temp.idx, 0,temp.partition_color, temp.actual_max_depth, tile_height);
+        Arguments for_right_sub_tree(n+1, l * 2 + 1, 2*actual_l+1 ,max_depth, temp.idx, 0, temp.partition_color, temp.actual_max_depth, tile_height);
+        tree.push( for_left_sub_tree );
+        tree.push( for_right_sub_tree );
+    }
+}
+
+// With pair_acc, args.pair_function is refined into the second field on the
+// same grid: a node is split when either function needs it, so both trees get
+// one shape and can share the tile partitions built from it.
+template<typename TREE_ACC>
+void refine_subtree( const Arguments &args, const TREE_ACC &tree_acc, vector<HelperArgs> &launch_entries, const TREE_ACC *pair_acc=NULL ){
+    queue<Arguments>tree;
+    tree.push(args);
+    int tile_height = args.tile_height;
+    map<coord_t, vector<NodeSample> > tile_samples, pair_samples;
+    while(!tree.empty()){
+        Arguments temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t actual_l = temp.actual_l;
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
+        int leaf_value, pair_value = 0;
+        bool refine = refine_decision(args.function, args.gen, args.refine_tolerance, temp, tile_samples, leaf_value);
+        if( pair_acc != NULL )
+            refine = refine_decision(args.pair_function, args.pair_gen, args.refine_tolerance, temp, pair_samples, pair_value) || refine;
+        write_refined_node(tree_acc, idx, actual_l, refine, leaf_value);
+        if( pair_acc != NULL )
+            write_refined_node(*pair_acc, idx, actual_l, refine, pair_value);
+        if( refine )
+            push_refine_children(args, temp, idx, tree, launch_entries);
+    }
+}
+
+// Retiling is a refine that takes each node, and so the shape, from a source
+// tree stored at source_tile_height. Norms and compressed values come across
+// unchanged, and the tile partitions get built the same way a refine at the
+// new height would build them.
+template<typename SOURCE_ACC, typename TREE_ACC>
+void retile_subtree( const Arguments &args, const SOURCE_ACC &source_acc, const TREE_ACC &tree_acc, vector<HelperArgs> &launch_entries ){
+    TreeLayout source(args.max_depth, args.source_tile_height);
+    queue<Arguments>tree;
+    tree.push(args);
+    while(!tree.empty()){
+        Arguments temp = tree.front();
+        tree.pop();
+        coord_t idx = temp.idx + temp.l + (1<<(temp.n%args.tile_height))-1;
+        tree_acc[idx] = source_acc[layout_node_index(source, temp.n, temp.actual_l)];
+        if( !tree_acc[idx].is_leaf )
+            push_refine_children(args, temp, idx, tree, launch_entries);
+    }
+}
+
+// Returns the tile root when the tile is the whole subtree and so could be
+// hashed here, and nothing when a rehash has to wait for child subtrees.
+SubtreeRoot refine_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    SubtreeRoot root;
+    // A tile with children also gets the child-range region, last.
+    bool child_ranges = regions.size() > ( args.source_tile_height > 0 ? 3u : 2u );
+    if( args.source_tile_height > 0 ){
+        const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > source_acc(regions[2], tree_field(task, 2));
+        retile_subtree(args, source_acc, tree_acc, launch_entries);
+        write_launch_entries(regions[1], launch_entries);
+        if( child_ranges )
+            write_child_ranges(regions.back(), args, launch_entries);
+        return root;
+    }
+    if( args.pair_function >= 0 ){
+        const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > pair_acc(regions[0], tree_field(task, 0, 1));
+        refine_subtree(args, tree_acc, launch_entries, &pair_acc);
+        if( launch_entries.empty() ){
+            hash_subtree(tree_acc, args.idx, args.n, 0, args.max_depth, args.tile_height);
+            hash_subtree(pair_acc, args.idx, args.n, 0, args.max_depth, args.tile_height);
+            root.add(tree_acc, args.idx);
+            root.add(pair_acc, args.idx);
+        }
+    }
+    else{
+        refine_subtree(args, tree_acc, launch_entries);
+        if( launch_entries.empty() ){
+            hash_subtree(tree_acc, args.idx, args.n, 0, args.max_depth, args.tile_height);
+            root.add(tree_acc, args.idx);
+        }
+    }
+    write_launch_entries(regions[1], launch_entries);
+    if( child_ranges )
+        write_child_ranges(regions.back(), args, launch_entries);
+    return root;
+}
+
+void compress_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
     queue<Arguments>tree;
     tree.push(args);
-    LogicalRegion lr = regions[0].get_logical_region();
-    LogicalPartition lp = LogicalPartition::NO_PART;
-    LogicalRegion my_sub_tree_lr = lr;
     int max_depth = args.max_depth;
     int tile_height = args.tile_height;
     int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], tree_field(task, 0));
+    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > write_acc(regions[1], FID_X);
     coord_t start_idx = args.idx;
     while(!tree.empty()){
         Arguments temp = tree.front();
         tree.pop();
         int n = temp.n;
         int l = temp.l;
-        int actual_l = temp.actual_l;
-        int carry = temp.carry;
+        coord_t actual_l = temp.actual_l;
         coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
+        if(read_acc[idx].is_leaf)
+            continue;
+        write_acc[helper_counter].actual_l = actual_l;
+        write_acc[helper_counter].level = l;
+        write_acc[helper_counter].idx = idx;
+        write_acc[helper_counter].n = n;
+        write_acc[helper_counter].is_valid_entry = true;
+        write_acc[helper_counter].height = subtree_height(read_acc[idx]);
+        write_acc[helper_counter].launch=false;
+        if( ((n % tile_height ) ==( tile_height-1 )) ){
+            write_acc[helper_counter].launch = true;
+        }
+        else if( !read_acc[idx].is_leaf ){
+                Arguments for_left_sub_tree (n + 1, l*2   , 2*actual_l, max_depth, temp.idx,0, temp.partition_color, temp.actual_max_depth, tile_height);
+                Arguments for_right_sub_tree(n + 1, l * 2 + 1, 2*actual_l+1, max_depth, temp.idx,0, temp.partition_color, temp.actual_max_depth, tile_height);
+                tree.push( for_left_sub_tree );
+                tree.push( for_right_sub_tree );
+        }
+        helper_counter++;
+    }
+}
+
+RootPosArgs child_compress_result( const Task *task, int child, int width ){
+    if( width == 0 )
+        return task->futures[child].get_result<RootPosArgs>();
+    return task->futures[child/width].get_result<CompressBatchResult>().member[child%width];
+}
+
+RootPosArgs compress_update_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > write_acc(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(regions[1], FID_X);
+    int tile_height = args.tile_height;
+    int entries = 1<<min(tile_height, args.max_depth-args.n);
+    int width = batch_width(args.max_depth, args.n+min(tile_height, args.max_depth-args.n), args.serial_cutoff);
+    int task_counter = -1;
+    for( int i = 0 ; i < entries ; i++ )
+        if( read_acc[i].is_valid_entry && read_acc[i].launch )
+            task_counter += 2;
+    for( int i = entries-1; i>=0 ; i-- ){
+        if( !read_acc[i].is_valid_entry )
+            continue;
+        coord_t idx = read_acc[i].idx;
+        if( write_acc[idx].is_leaf ){
+           write_acc[idx].norm = write_acc[idx].value*write_acc[idx].value;
+           write_acc[idx].hash = node_hash(write_acc[idx], 0, 0);
+           continue;
+        }
+        int nx = read_acc[i].n;
+        int l = read_acc[i].level;
+        int left_level = 2*l;
+        int right_level = 2*l+1;
+        coord_t idx_left_sub_tree,idx_right_sub_tree;
+        if((nx%tile_height)==(tile_height-1)){
+                RootPosArgs rightChild = child_compress_result(task, task_counter--, width);
+                RootPosArgs leftChild = child_compress_result(task, task_counter--, width);
+                write_acc[idx].value = leftChild.value + rightChild.value;
+                write_acc[idx].norm = subtree_norm(write_acc[idx].value, leftChild.norm, rightChild.norm);
+                write_acc[idx].hash = node_hash(write_acc[idx], leftChild.hash, rightChild.hash);
+        }
+        else{
+                idx_left_sub_tree = args.idx + left_level + (1<<((nx+1)%tile_height))-1;
+                idx_right_sub_tree = args.idx + right_level + (1<<((nx+1)%tile_height))-1;
+                write_acc[idx].value = write_acc[idx_left_sub_tree].value + write_acc[idx_right_sub_tree].value;
+                write_acc[idx].norm = subtree_norm(write_acc[idx].value, write_acc[idx_left_sub_tree].norm, write_acc[idx_right_sub_tree].norm);
+                write_acc[idx].hash = node_hash(write_acc[idx], subtree_hash(write_acc[idx_left_sub_tree]), subtree_hash(write_acc[idx_right_sub_tree]));
+        }
+    }
+    return RootPosArgs(write_acc[args.idx].value, write_acc[args.idx].norm, subtree_hash(write_acc[args.idx]));
+}
+
+
+TruncateResult child_truncate_result( const Task *task, int child, int width ){
+    if( width == 0 )
+        return task->futures[child].get_result<TruncateResult>();
+    return task->futures[child/width].get_result<TruncateBatchResult>().member[child%width];
+}
+
+TruncateResult truncate_update_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    int tile_height = min(args.tile_height,args.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int tolerance = args.tolerance;
+    int width = batch_width(args.max_depth, args.n+tile_height, args.serial_cutoff);
+    coord_t start_idx = args.idx;
+    vector<bool> reachable(tile_nodes,false);
+    vector<int> child_slot(tile_nodes,-1);
+    vector<TruncateResult> node_result(tile_nodes);
+    int task_counter=0;
+    reachable[0]=true;
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        if( !reachable[i] || tree_acc[start_idx+i].is_leaf )
+            continue;
+        if( 2*i+1 < tile_nodes ){
+            reachable[2*i+1] = true;
+            reachable[2*i+2] = true;
+        }
+        else{
+            child_slot[i] = task_counter;
+            task_counter+=2;
+        }
+    }
+    for( int i = tile_nodes-1 ; i >= 0 ; i-- ){
+        if( !reachable[i] )
+            continue;
+        coord_t idx = start_idx+i;
+        if( tree_acc[idx].is_leaf ){
+            int value = tree_acc[idx].value;
+            node_result[i] = TruncateResult(value*value, value, value*value <= tolerance*tolerance);
+            continue;
+        }
+        TruncateResult left, right;
+        if( child_slot[i] >= 0 ){
+            left = child_truncate_result(task, child_slot[i], width);
+            right = child_truncate_result(task, child_slot[i]+1, width);
+        }
+        else{
+            left = node_result[2*i+1];
+            right = node_result[2*i+2];
+        }
+        node_result[i] = TruncateResult(left.norm+right.norm, left.sum+right.sum, truncate_collapses(left,right,tolerance));
+        tree_acc[idx].norm = -1;
+        tree_acc[idx].hash = 0;
+        if( node_result[i].collapsible ){
+            tree_acc[idx].value = node_result[i].sum;
+            tree_acc[idx].is_leaf = true;
+            tree_acc[idx].norm = node_result[i].sum*node_result[i].sum;
+            tree_acc[idx].hash = node_hash(tree_acc[idx], 0, 0);
+        }
+    }
+    int launches = 0;
+    fill(reachable.begin(), reachable.end(), false);
+    reachable[0] = true;
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        if( !reachable[i] || tree_acc[start_idx+i].is_leaf )
+            continue;
+        if( 2*i+1 < tile_nodes )
+            reachable[2*i+1] = reachable[2*i+2] = true;
+        else
+            launches += 2;
+    }
+    node_result[0].reshaped = launches != task_counter;
+    return node_result[0];
+}
+
+
+
+template<typename TREE_ACC>
+void reconstruct_subtree( const Arguments &args, const TREE_ACC &tree_acc, vector<HelperArgs> &launch_entries ){
+    queue<Arguments>tree;
+    tree.push(args);
+    int max_depth = args.max_depth;
+    int tile_height = args.tile_height;
+    while(!tree.empty()){
+        Arguments temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t actual_l = temp.actual_l;
+        int carry = temp.carry;
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
+        // Reconstruct keeps the shape, so the height read before the hash
+        // goes stale still holds for the children launched below.
+        int height = subtree_height(tree_acc[idx]);
+        // An accumulated tree gets its lval here, not from the reduction.
+        tree_acc[idx].lval = actual_l;
+        tree_acc[idx].norm = -1;
+        tree_acc[idx].hash = 0;
         if(tree_acc[idx].is_leaf){
             tree_acc[idx].value+=carry;
             continue;
@@ -491,13 +3133,15 @@ void reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion>
             val/=2;
             tree_acc[idx].value=0;
             if( (n % tile_height )==( tile_height-1 ) ){
-                helper_acc[helper_counter].level = l;
-                helper_acc[helper_counter].idx = idx;
-                helper_acc[helper_counter].n = n;
-                helper_acc[helper_counter].launch = true;
-                helper_acc[helper_counter].actual_l = actual_l;
-                helper_acc[helper_counter].carry=val;
-                helper_counter++;
+                if( args.serial ){
+                    for( int child = 0 ; child < 2 ; child++ ){
+                        Arguments child_args(n+1, 0, 2*actual_l+child, max_depth, child_tile_start(temp.idx, tile_height, max_depth, n, l, child), 0, temp.partition_color, temp.actual_max_depth, tile_height);
+                        child_args.carry = val;
+                        tree.push( child_args );
+                    }
+                }
+                else
+                    launch_entries.push_back(HelperArgs(l, actual_l, idx, true, n, false, val, height));
             }
             else{
                 Arguments for_left_sub_tree (n+1, l * 2    ,2*actual_l, max_depth, temp.idx, 0,temp.partition_color, temp.actual_max_depth, tile_height);
@@ -511,40 +3155,48 @@ void reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion>
     }
 }
 
-int norm_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+// Returns the tile root as refine_intra_task does.
+SubtreeRoot reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    SubtreeRoot root;
+    reconstruct_subtree(args, tree_acc, launch_entries);
+    if( launch_entries.empty() ){
+        hash_subtree(tree_acc, args.idx, args.n, 0, args.max_depth, args.tile_height);
+        root.add(tree_acc, args.idx);
+    }
+    write_launch_entries(regions[1], launch_entries);
+    return root;
+}
+
+template<typename TREE_ACC>
+int norm_subtree( const Arguments &args, const TREE_ACC &tree_acc, vector<HelperArgs> &launch_entries ){
     queue<Arguments>tree;
     tree.push(args);
-    LogicalRegion lr = regions[0].get_logical_region();
-    LogicalPartition lp = LogicalPartition::NO_PART;
-    LogicalRegion my_sub_tree_lr = lr;
     int max_depth = args.max_depth;
     int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[1], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
-    coord_t start_idx = args.idx;
     int result=0;
     while(!tree.empty()){
         Arguments temp = tree.front();
         tree.pop();
         int n = temp.n;
         int l = temp.l;
-        int actual_l = temp.actual_l;
-        coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
+        coord_t actual_l = temp.actual_l;
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
         result+=tree_acc[idx].value*tree_acc[idx].value;
         if(tree_acc[idx].is_leaf){
             continue;
         }
         else{
             if( (n % tile_height )==( tile_height-1 ) ){
-                helper_acc[helper_counter].level = l;
-                helper_acc[helper_counter].idx = idx;
-                helper_acc[helper_counter].n = n;
-                helper_acc[helper_counter].launch = true;
-                helper_acc[helper_counter].actual_l = actual_l;
-                helper_counter++;
+                if( args.serial ){
+                    for( int child = 0 ; child < 2 ; child++ )
+                        tree.push( Arguments(n+1, 0, 2*actual_l+child, max_depth, child_tile_start(temp.idx, tile_height, max_depth, n, l, child), 0, temp.partition_color, temp.actual_max_depth, tile_height) );
+                }
+                else
+                    launch_entries.push_back(HelperArgs(l, actual_l, idx, true, n, false, 0, subtree_height(tree_acc[idx])));
             }
             else{
                 Arguments for_left_sub_tree (n+1, l * 2    ,2*actual_l, max_depth, temp.idx, 0,temp.partition_color, temp.actual_max_depth, tile_height);
@@ -557,200 +3209,548 @@ int norm_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions
     return result;
 }
 
+// Truncate runs this task for its launch entries alone, so only a norm
+// (args.memoize) may answer from the cache and queue nothing below the tile.
+// partition_inter_task also passes a child-range region as regions[2].
+TileProduct norm_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    unsigned long long hash = subtree_hash(tree_acc[args.idx]);
+    TileProduct result(0, hash, hash);
+    result.cached = args.memoize && lookup_product(hash, hash, result.value);
+    if( !result.cached )
+        result.value = norm_subtree(args, tree_acc, launch_entries);
+    write_launch_entries(regions[1], launch_entries);
+    if( regions.size() > 2 )
+        write_child_ranges(regions[2], args, launch_entries);
+    return result;
+}
+
 
-int inner_product_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    InnerProductArgs args = task->is_index_space ? *(const InnerProductArgs *) task->local_args
-    : *(const InnerProductArgs *) task->args;
+template<typename TREE_ACC>
+int inner_product_subtree( const InnerProductArgs &args, const TREE_ACC &tree1, const TREE_ACC &tree2, vector<HelperArgs> &launch_entries ){
     queue<InnerProductArgs>tree;
     tree.push(args);
     int max_depth = args.max_depth;
     int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[2], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], FID_X);
-    coord_t start_idx = args.idx;
     int result=0;
     while(!tree.empty()){
-        InnerProductArgs temp = tree.front();
+        InnerProductArgs temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
+        bool leaf1 = tree1[idx].is_leaf;
+        bool leaf2 = tree2[idx].is_leaf;
+        result = result + tree1[idx].value*tree2[idx].value;
+        if(leaf1||leaf2)
+            continue;
+        if((n% tile_height )==( tile_height-1 )){
+            if( args.serial ){
+                for( int child = 0 ; child < 2 ; child++ )
+                    tree.push( InnerProductArgs(n+1, 0, max_depth, child_tile_start(temp.idx, tile_height, max_depth, n, l, child), 0, temp.partition_color1, temp.partition_color2, temp.actual_max_depth, tile_height) );
+            }
+            else{
+                // The product stops where the shallower tree does.
+                int height1 = subtree_height(tree1[idx]), height2 = subtree_height(tree2[idx]);
+                launch_entries.push_back(HelperArgs(l, 0, idx, true, n, false, 0, height1 < 0 || height2 < 0 ? -1 : min(height1, height2)));
+            }
+        }
+        else{
+            InnerProductArgs for_left_sub_tree (n + 1, l * 2    , max_depth, temp.idx, temp.end_idx, temp.partition_color1, temp.partition_color2, temp.actual_max_depth, tile_height);
+            InnerProductArgs for_right_sub_tree(n + 1, l * 2 + 1, max_depth, temp.idx, temp.end_idx, temp.partition_color1, temp.partition_color2 ,temp.actual_max_depth, tile_height);
+            tree.push( for_left_sub_tree );
+            tree.push( for_right_sub_tree );
+        }
+    }
+    return result;
+}
+
+TileProduct inner_product_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    InnerProductArgs args = task->is_index_space ? *(const InnerProductArgs *) task->local_args
+    : *(const InnerProductArgs *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    vector<HelperArgs> launch_entries;
+    TileProduct result(0, subtree_hash(tree1[args.idx]), subtree_hash(tree2[args.idx]));
+    result.cached = lookup_product(result.hash1, result.hash2, result.value);
+    if( !result.cached )
+        result.value = inner_product_subtree(args, tree1, tree2, launch_entries);
+    write_launch_entries(regions[2], launch_entries);
+    return result;
+}
+
+
+template<typename READ_ACC, typename WRITE_ACC>
+void gaxpy_subtree( const GaxpyArgs &args, const READ_ACC &tree1, const READ_ACC &tree2, const WRITE_ACC &tree3, vector<GaxpyHelper> &launch_entries ){
+    int tile_height = args.tile_height;
+    queue<GaxpyArgs>tree;
+    tree.push(args);
+    int max_depth = args.max_depth;
+    while(!tree.empty()){
+        GaxpyArgs temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        int pass = temp.pass;
+        coord_t actual_l = temp.actual_l;
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
+        bool left_null = temp.left_null;
+        bool right_null = temp.right_null;
+        if( n > max_depth )
+            break;
+        bool leaf1 = !left_null && tree1[idx].is_leaf;
+        bool leaf2 = !right_null && tree2[idx].is_leaf;
+        int value1 = left_null ? 0 : tree1[idx].value;
+        int value2 = right_null ? 0 : tree2[idx].value;
+        GaxpyStep step(pass, left_null, right_null, leaf1, leaf2, value1, value2);
+        tree3[idx] = TreeArgs(step.value, actual_l, step.is_leaf);
+        if( step.is_leaf )
+            continue;
+        if((n%tile_height)==(tile_height-1)){
+            if( args.serial ){
+                for( int child = 0 ; child < 2 ; child++ ){
+                    GaxpyArgs child_args(n+1, 0, 2*actual_l+child, max_depth, child_tile_start(temp.idx, tile_height, max_depth, n, l, child), 0, temp.partition_color1, temp.partition_color2, temp.partition_color3, step.child_pass, step.child_left_null, step.child_right_null, temp.actual_max_depth, tile_height);
+                    tree.push( child_args );
+                }
+            }
+            else
+                launch_entries.push_back(GaxpyHelper(n, l, idx, step.child_pass, step.child_left_null, step.child_right_null, true, actual_l));
+        }
+        else{
+            GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l, max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, step.child_pass, step.child_left_null, step.child_right_null, temp.actual_max_depth, tile_height);
+            GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1, max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, step.child_pass, step.child_left_null, step.child_right_null, temp.actual_max_depth, tile_height);
+            tree.push( for_left_sub_tree );
+            tree.push( for_right_sub_tree );
+        }
+    }
+}
+
+void gaxpy_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    GaxpyArgs args = task->is_index_space ? *(const GaxpyArgs *) task->local_args
+    : *(const GaxpyArgs *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], tree_field(task, 2));
+    vector<GaxpyHelper> launch_entries;
+    gaxpy_subtree(args, tree1, tree2, tree3, launch_entries);
+    write_launch_entries(regions[3], launch_entries);
+}
+
+template<typename TREE_ACC>
+int compress_subtree( const TREE_ACC &tree_acc, coord_t tile_start, int n, int l, int max_depth, int tile_height ){
+    coord_t idx = tile_start + l + (1<<(n%tile_height))-1;
+    if( tree_acc[idx].is_leaf ){
+        tree_acc[idx].norm = tree_acc[idx].value*tree_acc[idx].value;
+        tree_acc[idx].hash = node_hash(tree_acc[idx], 0, 0);
+        return tree_acc[idx].value;
+    }
+    coord_t left_start = tile_start, right_start = tile_start;
+    int left_l = 2*l, right_l = 2*l+1;
+    if( (n % tile_height) == (tile_height-1) ){
+        left_start = child_tile_start(tile_start, tile_height, max_depth, n, l, 0);
+        right_start = child_tile_start(tile_start, tile_height, max_depth, n, l, 1);
+        left_l = right_l = 0;
+    }
+    int left = compress_subtree(tree_acc, left_start, n+1, left_l, max_depth, tile_height);
+    int right = compress_subtree(tree_acc, right_start, n+1, right_l, max_depth, tile_height);
+    tree_acc[idx].value = left + right;
+    const TreeArgs &left_node = tree_acc[left_start + left_l + (1<<((n+1)%tile_height))-1];
+    const TreeArgs &right_node = tree_acc[right_start + right_l + (1<<((n+1)%tile_height))-1];
+    tree_acc[idx].norm = subtree_norm(tree_acc[idx].value, left_node.norm, right_node.norm);
+    tree_acc[idx].hash = node_hash(tree_acc[idx], left_node.hash, right_node.hash);
+    return tree_acc[idx].value;
+}
+
+template<typename TREE_ACC>
+TruncateResult truncate_subtree( const TREE_ACC &tree_acc, coord_t tile_start, int n, int l, int max_depth, int tile_height, int tolerance ){
+    coord_t idx = tile_start + l + (1<<(n%tile_height))-1;
+    if( tree_acc[idx].is_leaf ){
+        int value = tree_acc[idx].value;
+        return TruncateResult(value*value, value, value*value <= tolerance*tolerance);
+    }
+    TruncateResult left, right;
+    if( (n % tile_height) == (tile_height-1) ){
+        left = truncate_subtree(tree_acc, child_tile_start(tile_start, tile_height, max_depth, n, l, 0), n+1, 0, max_depth, tile_height, tolerance);
+        right = truncate_subtree(tree_acc, child_tile_start(tile_start, tile_height, max_depth, n, l, 1), n+1, 0, max_depth, tile_height, tolerance);
+    }
+    else{
+        left = truncate_subtree(tree_acc, tile_start, n+1, 2*l, max_depth, tile_height, tolerance);
+        right = truncate_subtree(tree_acc, tile_start, n+1, 2*l+1, max_depth, tile_height, tolerance);
+    }
+    TruncateResult result(left.norm+right.norm, left.sum+right.sum, truncate_collapses(left,right,tolerance));
+    tree_acc[idx].norm = -1;
+    tree_acc[idx].hash = 0;
+    if( result.collapsible ){
+        tree_acc[idx].value = result.sum;
+        tree_acc[idx].is_leaf = true;
+        tree_acc[idx].norm = result.sum*result.sum;
+        tree_acc[idx].hash = node_hash(tree_acc[idx], 0, 0);
+    }
+    return result;
+}
+
+// Plain array standing in for a tree region, so the *_subtree kernels can run
+// outside any task.
+struct ArrayTree{
+    mutable vector<TreeArgs> nodes;
+    ArrayTree( int max_depth ) : nodes((1LL<<max_depth)+1, TreeArgs(0, 0)) {}
+    TreeArgs &operator[]( coord_t idx ) const { return nodes[idx]; }
+};
+
+// Single-threaded reference: the same kernels the intra and serial tasks use,
+// run in serial mode over arrays with the same dense layout, so timing it
+// against the Legion path shows what the runtime costs at each tile height.
+void run_reference( int max_depth, int tile_height, int truncate_tol, int second_max_depth, int second_tile_height, int function, double refine_tolerance ){
+    coord_t end_idx = (1LL<<max_depth)-1;
+    vector<HelperArgs> launch_entries;
+    last_report_time = wall_seconds();
+    ArrayTree tree1(max_depth);
+    Arguments args1(0, 0, 0, max_depth, 0, end_idx, 10, 0, tile_height);
+    args1.gen = rand();
+    args1.serial = true;
+    args1.function = function;
+    args1.refine_tolerance = refine_tolerance;
+    refine_subtree(args1, tree1, launch_entries);
+    report_wall_time("reference refine");
+    if( truncate_tol > 0 ){
+        truncate_subtree(tree1, 0, 0, 0, max_depth, tile_height, truncate_tol);
+        report_wall_time("reference truncate");
+    }
+    ArrayTree tree2(second_max_depth);
+    Arguments args2(0, 0, 0, second_max_depth, 0, (1LL<<second_max_depth)-1, 20, 0, second_tile_height);
+    args2.gen = rand();
+    args2.serial = true;
+    args2.function = function;
+    args2.refine_tolerance = refine_tolerance;
+    refine_subtree(args2, tree2, launch_entries);
+    report_wall_time("reference refine second tree");
+    if( second_max_depth != max_depth || second_tile_height != tile_height ){
+        cerr<<"Reference inner product and gaxpy need both trees in the same layout, skipping them"<<endl;
+    }
+    else{
+        InnerProductArgs product_args(0, 0, max_depth, 0, end_idx, 10, 20, 0, tile_height);
+        product_args.serial = true;
+        int product = inner_product_subtree(product_args, tree1, tree2, launch_entries);
+        report_wall_time("reference inner product");
+        cout<<"inner tree1 tree2 = "<<product<<endl;
+        ArrayTree tree3(max_depth);
+        GaxpyArgs gaxpy_args(0, 0, 0, max_depth, 0, end_idx, 10, 20, 30, 0, false, false, 0, tile_height);
+        gaxpy_args.serial = true;
+        vector<GaxpyHelper> gaxpy_entries;
+        gaxpy_subtree(gaxpy_args, tree1, tree2, tree3, gaxpy_entries);
+        report_wall_time("reference gaxpy");
+        Arguments args3(0, 0, 0, max_depth, 0, end_idx, 30, 0, tile_height);
+        args3.serial = true;
+        int gaxpy_norm = norm_subtree(args3, tree3, launch_entries);
+        report_wall_time("reference gaxpy norm");
+        cout<<"norm gaxpy = "<<sqrt(gaxpy_norm)<<endl;
+    }
+    int norm = norm_subtree(args1, tree1, launch_entries);
+    report_wall_time("reference norm");
+    cout<<"norm tree1 = "<<sqrt(norm)<<endl;
+    compress_subtree(tree1, 0, 0, 0, max_depth, tile_height);
+    report_wall_time("reference compress");
+    args1.carry = 0;
+    reconstruct_subtree(args1, tree1, launch_entries);
+    report_wall_time("reference reconstruct");
+    cout<<"norm tree1 after reconstruct = "<<sqrt(norm_subtree(args1, tree1, launch_entries))<<endl;
+}
+
+// Serial leaf tasks: each point of the launch owns a batch of consecutive
+// sibling subtrees that are small enough to finish without further launches.
+SubtreeRootBatch serial_refine_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<Arguments> batch = unpack_batch<Arguments>(task);
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    SubtreeRootBatch result;
+    if( batch[0].source_tile_height > 0 ){
+        const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > source_acc(regions[1], tree_field(task, 1));
+        for( size_t i = 0 ; i < batch.size() ; i++ )
+            retile_subtree(batch[i], source_acc, tree_acc, launch_entries);
+        return result;
+    }
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > pair_acc(regions[0], tree_field(task, 0, batch[0].pair_function >= 0 ? 1 : 0));
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        refine_subtree(batch[i], tree_acc, launch_entries, batch[i].pair_function >= 0 ? &pair_acc : NULL);
+        SubtreeRoot &root = result.member[result.count++];
+        hash_subtree(tree_acc, batch[i].idx, batch[i].n, 0, batch[i].max_depth, batch[i].tile_height);
+        root.add(tree_acc, batch[i].idx);
+        if( batch[i].pair_function >= 0 ){
+            hash_subtree(pair_acc, batch[i].idx, batch[i].n, 0, batch[i].max_depth, batch[i].tile_height);
+            root.add(pair_acc, batch[i].idx);
+        }
+    }
+    return result;
+}
+
+CompressBatchResult serial_compress_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<Arguments> batch = unpack_batch<Arguments>(task);
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    CompressBatchResult result;
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        int value = compress_subtree(tree_acc, batch[i].idx, batch[i].n, 0, batch[i].max_depth, batch[i].tile_height);
+        result.member[result.count++] = RootPosArgs(value, tree_acc[batch[i].idx].norm, tree_acc[batch[i].idx].hash);
+    }
+    return result;
+}
+
+SubtreeRootBatch serial_reconstruct_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<Arguments> batch = unpack_batch<Arguments>(task);
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    SubtreeRootBatch result;
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        reconstruct_subtree(batch[i], tree_acc, launch_entries);
+        hash_subtree(tree_acc, batch[i].idx, batch[i].n, 0, batch[i].max_depth, batch[i].tile_height);
+        result.member[result.count++].add(tree_acc, batch[i].idx);
+    }
+    return result;
+}
+
+int serial_norm_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<Arguments> batch = unpack_batch<Arguments>(task);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    vector<HelperArgs> launch_entries;
+    int result=0;
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        unsigned long long hash = subtree_hash(tree_acc[batch[i].idx]);
+        int member;
+        if( !lookup_product(hash, hash, member) ){
+            member = norm_subtree(batch[i], tree_acc, launch_entries);
+            store_product(hash, hash, member);
+        }
+        result+=member;
+    }
+    return result;
+}
+
+TruncateBatchResult serial_truncate_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<Arguments> batch = unpack_batch<Arguments>(task);
+    const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], tree_field(task, 0));
+    TruncateBatchResult result;
+    for( size_t i = 0 ; i < batch.size() ; i++ )
+        result.member[result.count++] = truncate_subtree(tree_acc, batch[i].idx, batch[i].n, 0, batch[i].max_depth, batch[i].tile_height, batch[i].tolerance);
+    return result;
+}
+
+int serial_inner_product_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<InnerProductArgs> batch = unpack_batch<InnerProductArgs>(task);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    vector<HelperArgs> launch_entries;
+    int result=0;
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        unsigned long long hash1 = subtree_hash(tree1[batch[i].idx]);
+        unsigned long long hash2 = subtree_hash(tree2[batch[i].idx]);
+        int member;
+        if( !lookup_product(hash1, hash2, member) ){
+            member = inner_product_subtree(batch[i], tree1, tree2, launch_entries);
+            store_product(hash1, hash2, member);
+        }
+        result+=member;
+    }
+    return result;
+}
+
+void serial_gaxpy_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<GaxpyArgs> batch = unpack_batch<GaxpyArgs>(task);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], tree_field(task, 2));
+    vector<GaxpyHelper> launch_entries;
+    for( size_t i = 0 ; i < batch.size() ; i++ )
+        gaxpy_subtree(batch[i], tree1, tree2, tree3, launch_entries);
+}
+
+// Tree 1's tile layout drives the walk; tree 2 is read at the same
+// positions through its own layout.
+template<typename TREE_ACC>
+int inner_product_mixed_subtree( const MixedArgs &args, const TREE_ACC &tree1, const TREE_ACC &tree2, vector<HelperArgs> &launch_entries ){
+    queue<MixedArgs>tree;
+    tree.push(args);
+    int tile_height = args.layout1.tile_height;
+    int result=0;
+    while(!tree.empty()){
+        MixedArgs temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t actual_l = temp.actual_l;
+        coord_t idx1 = temp.idx + l + (1<<(n%tile_height))-1;
+        coord_t idx2 = layout_node_index(args.layout2, n, actual_l);
+        result = result + tree1[idx1].value*tree2[idx2].value;
+        if(tree1[idx1].is_leaf||tree2[idx2].is_leaf)
+            continue;
+        if((n% tile_height )==( tile_height-1 )){
+            if( args.serial ){
+                for( int child = 0 ; child < 2 ; child++ )
+                    tree.push( MixedArgs(n+1, 0, 2*actual_l+child, child_tile_start(temp.idx, tile_height, args.layout1.max_depth, n, l, child), 0, temp.layout1, temp.layout2) );
+            }
+            else
+                launch_entries.push_back(HelperArgs(l, actual_l, idx1, true, n));
+        }
+        else{
+            MixedArgs for_left_sub_tree (n + 1, l * 2    , 2*actual_l  , temp.idx, temp.end_idx, temp.layout1, temp.layout2);
+            MixedArgs for_right_sub_tree(n + 1, l * 2 + 1, 2*actual_l+1, temp.idx, temp.end_idx, temp.layout1, temp.layout2);
+            tree.push( for_left_sub_tree );
+            tree.push( for_right_sub_tree );
+        }
+    }
+    return result;
+}
+
+int inner_product_mixed_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    vector<HelperArgs> launch_entries;
+    int result = inner_product_mixed_subtree(args, tree1, tree2, launch_entries);
+    write_launch_entries(regions[2], launch_entries);
+    return result;
+}
+
+int serial_inner_product_mixed_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<MixedArgs> batch = unpack_batch<MixedArgs>(task);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    vector<HelperArgs> launch_entries;
+    int result=0;
+    for( size_t i = 0 ; i < batch.size() ; i++ )
+        result+=inner_product_mixed_subtree(batch[i], tree1, tree2, launch_entries);
+    return result;
+}
+
+InnerProductEstimate inner_product_screened_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    ScreenedArgs args = task->is_index_space ? *(const ScreenedArgs *) task->local_args
+    : *(const ScreenedArgs *) task->args;
+    queue<ScreenedArgs>tree;
+    tree.push(args);
+    int tile_height = args.layout1.tile_height;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    vector<HelperArgs> launch_entries;
+    InnerProductEstimate result;
+    while(!tree.empty()){
+        ScreenedArgs temp = tree.front();
         tree.pop();
         int n = temp.n;
         int l = temp.l;
-        coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
-        bool leaf1 = tree1[idx].is_leaf;
-        bool leaf2 = tree2[idx].is_leaf;
-        result = result + tree1[idx].value*tree2[idx].value;
-        if(leaf1||leaf2)
+        coord_t actual_l = temp.actual_l;
+        coord_t idx1 = args.idx + l + (1<<(n%tile_height))-1;
+        coord_t idx2 = layout_node_index(args.layout2, n, actual_l);
+        TreeArgs node1 = tree1[idx1];
+        TreeArgs node2 = tree2[idx2];
+        result.estimate += node1.value*node2.value;
+        if(node1.is_leaf||node2.is_leaf)
+            continue;
+        double bound = descendant_bound(node1, node2);
+        if( bound >= 0 && bound < args.tolerance ){
+            result.error_bound += bound;
             continue;
-        if((n% tile_height )==( tile_height-1 )){
-            helper_acc[helper_counter].n = n;
-            helper_acc[helper_counter].level =l;
-            helper_acc[helper_counter].idx = idx;
-            helper_acc[helper_counter].launch=true;
-            helper_counter++;
         }
+        if((n% tile_height )==( tile_height-1 ))
+            launch_entries.push_back(HelperArgs(l, actual_l, idx1, true, n));
         else{
-            InnerProductArgs for_left_sub_tree (n + 1, l * 2    , max_depth, temp.idx, temp.end_idx, temp.partition_color1, temp.partition_color2, temp.actual_max_depth, tile_height);
-            InnerProductArgs for_right_sub_tree(n + 1, l * 2 + 1, max_depth, temp.idx, temp.end_idx, temp.partition_color1, temp.partition_color2 ,temp.actual_max_depth, tile_height);
-            tree.push( for_left_sub_tree );
-            tree.push( for_right_sub_tree );
+            tree.push( ScreenedArgs(n + 1, l * 2    , 2*actual_l  , temp.idx, temp.end_idx, temp.layout1, temp.layout2, temp.tolerance) );
+            tree.push( ScreenedArgs(n + 1, l * 2 + 1, 2*actual_l+1, temp.idx, temp.end_idx, temp.layout1, temp.layout2, temp.tolerance) );
         }
     }
+    write_launch_entries(regions[2], launch_entries);
     return result;
 }
 
 
-void gaxpy_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    GaxpyArgs args = task->is_index_space ? *(const GaxpyArgs *) task->local_args
-    : *(const GaxpyArgs *) task->args;
-    int tile_height = args.tile_height;
-    queue<GaxpyArgs>tree;
+// Tree 3's tile layout drives the walk; the inputs are read at the same
+// positions through their own layouts.
+template<typename READ_ACC, typename WRITE_ACC>
+void gaxpy_mixed_subtree( const MixedArgs &args, const READ_ACC &tree1, const READ_ACC &tree2, const WRITE_ACC &tree3, vector<GaxpyHelper> &launch_entries ){
+    int tile_height = args.layout3.tile_height;
+    queue<MixedArgs>tree;
     tree.push(args);
-    int helper_counter=0;
-    int max_depth = args.max_depth;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], FID_X);    
-    const FieldAccessor<WRITE_DISCARD,GaxpyHelper,1,coord_t,Realm::AffineAccessor<GaxpyHelper,1,coord_t> > helper_acc(regions[3], FID_X); 
-    coord_t start_idx = args.idx;
     while(!tree.empty()){
-        GaxpyArgs temp = tree.front();
+        MixedArgs temp = tree.front();
         tree.pop();
         int n = temp.n;
         int l = temp.l;
+        coord_t actual_l = temp.actual_l;
         int pass = temp.pass;
-        int actual_l = temp.actual_l;
-        coord_t idx = start_idx + l + (1<<(n%tile_height))-1;
         bool left_null = temp.left_null;
         bool right_null = temp.right_null;
-        int value;
-        if( n > max_depth )
-            break;
-        tree3[idx].lval = actual_l;
-        if( left_null ){
-            if(tree2[idx].is_leaf){
-                value = pass + tree2[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
-            }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = pass/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].actual_l = actual_l;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l, max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1, max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }
-            }
+        coord_t idx = temp.idx + l + (1<<(n%tile_height))-1;
+        bool leaf1 = false, leaf2 = false;
+        int value1 = 0, value2 = 0;
+        if( !left_null ){
+            coord_t idx1 = layout_node_index(args.layout1, n, actual_l);
+            leaf1 = tree1[idx1].is_leaf;
+            value1 = tree1[idx1].value;
         }
-        else if( right_null ){
-            if( tree1[idx].is_leaf){
-                value = pass + tree1[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
-            }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = pass/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].actual_l = actual_l;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l,max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1 ,max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
+        if( !right_null ){
+            coord_t idx2 = layout_node_index(args.layout2, n, actual_l);
+            leaf2 = tree2[idx2].is_leaf;
+            value2 = tree2[idx2].value;
+        }
+        GaxpyStep step(pass, left_null, right_null, leaf1, leaf2, value1, value2, args.multiply);
+        tree3[idx] = TreeArgs(step.value, actual_l, step.is_leaf);
+        if( step.is_leaf )
+            continue;
+        if((n%tile_height)==(tile_height-1)){
+            if( args.serial ){
+                for( int child = 0 ; child < 2 ; child++ )
+                    tree.push( MixedArgs(n+1, 0, 2*actual_l+child, child_tile_start(temp.idx, tile_height, args.layout3.max_depth, n, l, child), 0, temp.layout1, temp.layout2, temp.layout3, step.child_pass, step.child_left_null, step.child_right_null) );
             }
+            else
+                launch_entries.push_back(GaxpyHelper(n, l, idx, step.child_pass, step.child_left_null, step.child_right_null, true, actual_l));
         }
         else{
-            if( (tree1[idx].is_leaf )&&( tree2[idx].is_leaf )){
-                value = tree1[idx].value + tree2[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
-            }
-            else if(tree1[idx].is_leaf){
-                value = tree1[idx].value;
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = value/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].actual_l = actual_l;
-                    helper_acc[helper_counter].left_null = true;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l,max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, true, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1,max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, true, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
-            }
-            else if(tree2[idx].is_leaf){
-                value = tree2[idx].value;
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = value/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].actual_l = actual_l;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = true;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l,max_depth, temp.idx, 0,temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, left_null, true, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1,max_depth, temp.idx,0, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, left_null, true, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
-            }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = 0;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].actual_l = actual_l;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, 2*actual_l,max_depth, temp.idx, 0, temp.partition_color1, temp.partition_color2, temp.partition_color3, 0, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1,max_depth, temp.idx, 0, temp.partition_color1, temp.partition_color2, temp.partition_color3, 0, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
-            }
+            MixedArgs for_left_sub_tree (n+1, l*2  , 2*actual_l  , temp.idx, temp.end_idx, temp.layout1, temp.layout2, temp.layout3, step.child_pass, step.child_left_null, step.child_right_null);
+            MixedArgs for_right_sub_tree(n+1, l*2+1, 2*actual_l+1, temp.idx, temp.end_idx, temp.layout1, temp.layout2, temp.layout3, step.child_pass, step.child_left_null, step.child_right_null);
+            tree.push( for_left_sub_tree );
+            tree.push( for_right_sub_tree );
         }
     }
 }
 
+SubtreeRoot gaxpy_mixed_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], tree_field(task, 2));
+    vector<GaxpyHelper> launch_entries;
+    gaxpy_mixed_subtree(args, tree1, tree2, tree3, launch_entries);
+    write_launch_entries(regions[3], launch_entries);
+    SubtreeRoot root;
+    if( launch_entries.empty() ){
+        hash_subtree(tree3, args.idx, args.n, args.l, args.layout3.max_depth, args.layout3.tile_height);
+        root.add(tree3, args.idx);
+    }
+    return root;
+}
+
+SubtreeRootBatch serial_gaxpy_mixed_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<MixedArgs> batch = unpack_batch<MixedArgs>(task);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1));
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], tree_field(task, 2));
+    vector<GaxpyHelper> launch_entries;
+    SubtreeRootBatch result;
+    for( size_t i = 0 ; i < batch.size() ; i++ ){
+        gaxpy_mixed_subtree(batch[i], tree1, tree2, tree3, launch_entries);
+        hash_subtree(tree3, batch[i].idx, batch[i].n, 0, batch[i].layout3.max_depth, batch[i].layout3.tile_height);
+        result.member[result.count++].add(tree3, batch[i].idx);
+    }
+    return result;
+}
+
 void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     GaxpyArgs args = task->is_index_space ? *(const GaxpyArgs *) task->local_args
     : *(const GaxpyArgs *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
@@ -795,22 +3795,11 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
         subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
         childtree = runtime->get_logical_subregion_by_color(ctx,lp,1);
     }
+    ScratchResources scratch(ctx, runtime);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion new_helper_Region = scratch.create_region<GaxpyHelper>(helper_Array);
     Rect<1> dummy_Array(0,0);
-    is = runtime->create_index_space(ctx, dummy_Array);
-    fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
-    }
-    LogicalRegion dummy_region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion dummy_region = scratch.create_region<TreeArgs>(dummy_Array);
     RegionRequirement reqd(dummy_region, WRITE_DISCARD, EXCLUSIVE , dummy_region);
     RegionRequirement req4(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
     req4.add_field(FID_X);
@@ -821,11 +3810,12 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
         RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
         req3.add_field(FID_X);
         TaskLauncher gaxpy_intra_launcher(GAXPY_INTRA_TASK_ID, TaskArgument(&args,sizeof(GaxpyArgs)));
+        gaxpy_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
         gaxpy_intra_launcher.add_region_requirement(reqd);
         gaxpy_intra_launcher.add_region_requirement(req2);
         gaxpy_intra_launcher.add_region_requirement(req3);
         gaxpy_intra_launcher.add_region_requirement(req4);
-        runtime->execute_task(ctx,gaxpy_intra_launcher);
+        execute_resident(ctx, runtime, gaxpy_intra_launcher);
     }
     else if(args.right_null){
         RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
@@ -833,11 +3823,12 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
         RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
         req3.add_field(FID_X);
         TaskLauncher gaxpy_intra_launcher(GAXPY_INTRA_TASK_ID, TaskArgument(&args,sizeof(GaxpyArgs)));
+        gaxpy_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
         gaxpy_intra_launcher.add_region_requirement(req1);
         gaxpy_intra_launcher.add_region_requirement(reqd);
         gaxpy_intra_launcher.add_region_requirement(req3);
         gaxpy_intra_launcher.add_region_requirement(req4);
-        runtime->execute_task(ctx,gaxpy_intra_launcher);
+        execute_resident(ctx, runtime, gaxpy_intra_launcher);
     }
     else{
         RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
@@ -847,13 +3838,14 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
         RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
         req3.add_field(FID_X);
         TaskLauncher gaxpy_intra_launcher(GAXPY_INTRA_TASK_ID, TaskArgument(&args,sizeof(GaxpyArgs)));
+        gaxpy_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
         gaxpy_intra_launcher.add_region_requirement(req1);
         gaxpy_intra_launcher.add_region_requirement(req2);
         gaxpy_intra_launcher.add_region_requirement(req3);
         gaxpy_intra_launcher.add_region_requirement(req4);
-        runtime->execute_task(ctx,gaxpy_intra_launcher);
+        execute_resident(ctx, runtime, gaxpy_intra_launcher);
     }
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req4 );
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
     const FieldAccessor<READ_ONLY,GaxpyHelper,1,coord_t,Realm::AffineAccessor<GaxpyHelper,1,coord_t> > read_acc(physicalRegion, FID_X);
     vector<pair<coord_t,coord_t> >color_index_left, color_index_right, color_index_both;
     coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
@@ -865,7 +3857,7 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
             break;
         int nx = read_acc[i].n;
         int pass = read_acc[i].pass;
-        int actual_l = read_acc[i].actual_l;
+        coord_t actual_l = read_acc[i].actual_l;
         int level = read_acc[i].l;
         coord_t left_level = 2*level;
         coord_t right_level = left_level+1;
@@ -875,38 +3867,62 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
         coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
         GaxpyArgs left_args( nx+1, 0, 2*actual_l, args.max_depth, idx_left_sub_tree, idx_right_sub_tree-1, args.partition_color1, args.partition_color2, args.partition_color3, pass, left_null, right_null , args.actual_max_depth, args.tile_height);
         GaxpyArgs right_args( nx+1, 0 , 2*actual_l+1 ,args.max_depth, idx_right_sub_tree,idx_right_sub_tree + sub_tree_size-1 ,args.partition_color1, args.partition_color2, args.partition_color3, pass, left_null, right_null , args.actual_max_depth, args.tile_height);
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
         argsReqd.push_back(left_args);
         argsReqd.push_back(right_args);
         color_index.push_back(make_pair(idx_left_sub_tree,idx_right_sub_tree-1));
         color_index.push_back(make_pair(idx_right_sub_tree, idx_right_sub_tree +  sub_tree_size-1 ) );
     }
+    runtime->unmap_region(ctx, physicalRegion);
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
     if(color_index.size() > 0 ){
         is = childtree.get_index_space();
-        DomainPointColoring coloring;
-        for( int i = 0 ; i < color_index.size() ; i++ ){
-            coloring[i]= Rect<1>(color_index[i].first,color_index[i].second);
-        }
-        Rect<1>color_space = Rect<1>(0,color_index.size()-1);
+        DomainPointColoring coloring = batch_coloring(color_index, width);
+        Rect<1>color_space = Rect<1>(0,batch_count(color_index.size(), width)-1);
         ip = runtime->create_index_partition(ctx, is, color_space, coloring, DISJOINT_KIND, args.partition_color3);
         lp = runtime->get_logical_partition(ctx, childtree, ip);
     }
+    if( width > 0 && argsReqd.size() > 0 ){
+        ArgumentMap arg_map;
+        vector<vector<char> > buffers;
+        batch_argument_map(arg_map, argsReqd, width, buffers);
+        Rect<1> launch_domain(0,batch_count(argsReqd.size(), width)-1);
+        IndexTaskLauncher serial_launcher(SERIAL_GAXPY_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        serial_launcher.tag = subtree_priority(args.max_depth, n+tile_height);
+        if(args.left_null)
+            serial_launcher.add_region_requirement(RegionRequirement(dummy_region,READ_ONLY,EXCLUSIVE,dummy_region));
+        else
+            serial_launcher.add_region_requirement(RegionRequirement(childtree1,READ_ONLY,EXCLUSIVE,lr1));
+        if(args.right_null)
+            serial_launcher.add_region_requirement(RegionRequirement(dummy_region,READ_ONLY,EXCLUSIVE,dummy_region));
+        else
+            serial_launcher.add_region_requirement(RegionRequirement(childtree2,READ_ONLY,EXCLUSIVE,lr2));
+        serial_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD,EXCLUSIVE,lr));
+        serial_launcher.add_field(0,FID_X);
+        serial_launcher.add_field(1,FID_X);
+        serial_launcher.add_field(2,FID_X);
+        execute_resident(ctx, runtime, serial_launcher);
+        return;
+    }
     for( int i = 0 ; i < argsReqd.size(); i++ ){
         GaxpyArgs currentArg = argsReqd[i];
         TaskLauncher gaxpy_launcher(GAXPY_INTER_TASK_ID,TaskArgument(&currentArg,sizeof(GaxpyArgs)));
+        gaxpy_launcher.tag = subtree_priority(args.max_depth, n+tile_height);
         LogicalRegion currentTile = runtime->get_logical_subregion_by_color(ctx,lp,i);
         if(currentArg.left_null){
             gaxpy_launcher.add_region_requirement(RegionRequirement(childtree2,READ_ONLY,EXCLUSIVE,lr2));
             gaxpy_launcher.add_region_requirement(RegionRequirement(currentTile,WRITE_DISCARD,EXCLUSIVE,lr));
-            gaxpy_launcher.add_field(0,FID_X);
-            gaxpy_launcher.add_field(1,FID_X);
-            runtime->execute_task(ctx,gaxpy_launcher);
+            gaxpy_launcher.add_field(0,FID_X, false);
+            gaxpy_launcher.add_field(1,FID_X, false);
+            execute_resident(ctx, runtime, gaxpy_launcher);
         }
         else if(currentArg.right_null){
             gaxpy_launcher.add_region_requirement(RegionRequirement(childtree1,READ_ONLY,EXCLUSIVE,lr1));
             gaxpy_launcher.add_region_requirement(RegionRequirement(currentTile,WRITE_DISCARD,EXCLUSIVE,lr));
-            gaxpy_launcher.add_field(0,FID_X);
-            gaxpy_launcher.add_field(1,FID_X);
-            runtime->execute_task(ctx,gaxpy_launcher);
+            gaxpy_launcher.add_field(0,FID_X, false);
+            gaxpy_launcher.add_field(1,FID_X, false);
+            execute_resident(ctx, runtime, gaxpy_launcher);
         }
         else{
             gaxpy_launcher.add_region_requirement(RegionRequirement(childtree1,READ_ONLY,EXCLUSIVE,lr1));
@@ -915,7 +3931,7 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
             gaxpy_launcher.add_field(0,FID_X);
             gaxpy_launcher.add_field(1,FID_X);
             gaxpy_launcher.add_field(2,FID_X);
-            runtime->execute_task(ctx,gaxpy_launcher);
+            execute_resident(ctx, runtime, gaxpy_launcher);
         }
     }
 }
@@ -923,6 +3939,8 @@ void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regio
 int inner_product_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     InnerProductArgs args = task->is_index_space ? *(const InnerProductArgs *) task->local_args
     : *(const InnerProductArgs *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
@@ -943,69 +3961,834 @@ int inner_product_inter_task(const Task *task, const std::vector<PhysicalRegion>
         subtree1 = runtime->get_logical_subregion_by_color(ctx, lp1, 0);
         subtree2 = runtime->get_logical_subregion_by_color(ctx, lp2, 0);
     }
+    ScratchResources scratch(ctx, runtime);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    TaskLauncher inner_product_intra_launcher(INNER_PRODUCT_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    inner_product_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
+    RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
+    RegionRequirement req2(subtree2,READ_ONLY,EXCLUSIVE,lr2);
+    RegionRequirement req3(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req1, task, 0);
+    add_tree_fields(req2, task, 1);
+    req3.add_field(FID_X);
+    inner_product_intra_launcher.add_region_requirement(req1);
+    inner_product_intra_launcher.add_region_requirement(req2);
+    inner_product_intra_launcher.add_region_requirement(req3);
+    Future tile_result = execute_resident(ctx, runtime, inner_product_intra_launcher, !args.prefetch || n == 0);
+    ArgumentMap arg_map;
+    coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    if( args.prefetch && width == 0 && args.idx + tile_nodes < args.end_idx ){
+        int child_tile_height = min(args.tile_height, args.max_depth-n-tile_height);
+        prefetch_child_tiles(ctx, runtime, scratch, childtree1, lr1, tree_field(task, 0), start_idx, sub_tree_size, tile_height, child_tile_height);
+        prefetch_child_tiles(ctx, runtime, scratch, childtree2, lr2, tree_field(task, 1), start_idx, sub_tree_size, tile_height, child_tile_height);
+    }
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    vector<InnerProductArgs> child_args;
+    vector<TaskPriority> priorities;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
+        if(!read_acc[i].launch){
+            break;
+        }
+        int level = read_acc[i].level;
+        int nx = read_acc[i].n;
+        coord_t left_level = 2*level;
+        coord_t right_level = left_level+1;
+        coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
+        coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
+        InnerProductArgs left_args( nx+1 , 0, args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1, args.partition_color1 , args.partition_color2, args.actual_max_depth , args.tile_height);
+        InnerProductArgs right_args( nx+1 , 0, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1 , args.partition_color1, args.partition_color2 ,args.actual_max_depth, args.tile_height);
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
+        left_args.prefetch = args.prefetch;
+        right_args.prefetch = args.prefetch;
+        child_args.push_back(left_args);
+        child_args.push_back(right_args);
+        priorities.insert(priorities.end(), 2, child_priority(args.max_depth, nx+1, read_acc[i].height));
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    int result=0;
+    int task_counter = batch_count(child_args.size(), width);
+    vector<vector<char> > buffers;
+    if( task_counter > 0 ){
+        batch_argument_map(arg_map, child_args, width, buffers, &priorities);
+        lp1 = runtime->get_logical_partition_by_color(ctx,childtree1,args.partition_color1);
+        lp2 = runtime->get_logical_partition_by_color(ctx,childtree2,args.partition_color2);
+        Rect<1> launch_domain(0,task_counter-1);
+        IndexTaskLauncher product_launcher(width == 0 ? INNER_PRODUCT_INTER_TASK_ID : SERIAL_INNER_PRODUCT_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        product_launcher.tag = subtree_priority(args.max_depth, n+tile_height) | POINT_PRIORITY_TAG;
+        product_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
+        product_launcher.add_region_requirement(RegionRequirement(lp2,0,READ_ONLY, EXCLUSIVE, lr2));
+        add_tree_fields(product_launcher.region_requirements[0], task, 0, width != 0);
+        add_tree_fields(product_launcher.region_requirements[1], task, 1, width != 0);
+        FutureMap f_result = execute_resident(ctx, runtime, product_launcher);
+        for( int i = 0 ; i < task_counter ; i++ )
+            result = result + f_result.get_result<int>(i);
+    }
+    TileProduct tile = tile_result.get_result<TileProduct>();
+    result+=tile.value;
+    if( !tile.cached )
+        store_product(tile.hash1, tile.hash2, result);
+    return result;
+}
+
+int inner_product_mixed_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    int tile_height = args.layout1.tile_height;
+    tile_height = min(tile_height,args.layout1.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    LogicalRegion subtree1,childtree1;
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(args.idx,args.idx+tile_nodes-1);
+    Rect<1>tile_space = Rect<1>(0,0);
+    if(args.idx + tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(args.idx+tile_nodes,args.end_idx);
+        tile_space = Rect<1>(0,1);
+    }
+    ScratchResources scratch(ctx, runtime);
+    LogicalPartition lp1 = runtime->get_logical_partition(ctx, lr1, scratch.adopt(runtime->create_index_partition(ctx, lr1.get_index_space(), tile_space, colorStartTile, DISJOINT_KIND)));
+    subtree1 = runtime->get_logical_subregion_by_color(ctx, lp1, 0);
+    if(args.idx + tile_nodes < args.end_idx )
+        childtree1 = runtime->get_logical_subregion_by_color(ctx,lp1,1);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    TaskLauncher inner_product_intra_launcher(INNER_PRODUCT_MIXED_INTRA_TASK_ID, TaskArgument(&args, sizeof(MixedArgs) ) );
+    inner_product_intra_launcher.tag = subtree_priority(min(args.layout1.max_depth, args.layout2.max_depth), n);
+    RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
+    RegionRequirement req2(tile_overlap_region(ctx, runtime, scratch, lr2, args.layout2, n, args.actual_l, tile_height), READ_ONLY, EXCLUSIVE, lr2);
+    RegionRequirement req3(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req1, task, 0);
+    add_tree_fields(req2, task, 1);
+    req3.add_field(FID_X);
+    inner_product_intra_launcher.add_region_requirement(req1);
+    inner_product_intra_launcher.add_region_requirement(req2);
+    inner_product_intra_launcher.add_region_requirement(req3);
+    Future tile_result = execute_resident(ctx, runtime, inner_product_intra_launcher);
+    ArgumentMap arg_map;
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    coord_t sub_tree_size = (1LL<<(args.layout1.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    vector<MixedArgs> child_args;
+    vector<pair<coord_t,coord_t> > ranges1, ranges2;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
+        if(!read_acc[i].launch){
+            break;
+        }
+        int level = read_acc[i].level;
+        int nx = read_acc[i].n;
+        coord_t actual_l = read_acc[i].actual_l;
+        coord_t idx_left_sub_tree = start_idx+2*level*sub_tree_size;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t child_idx = idx_left_sub_tree+child*sub_tree_size;
+            child_args.push_back(MixedArgs(nx+1, 0, 2*actual_l+child, child_idx, child_idx+sub_tree_size-1, args.layout1, args.layout2));
+            child_args.back().serial_cutoff = args.serial_cutoff;
+            ranges1.push_back(make_pair(child_idx, child_idx+sub_tree_size-1));
+            ranges2.push_back(layout_subtree_range(args.layout2, nx+1, 2*actual_l+child));
+        }
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    // All children sit at one level, so their tree-2 ranges come in order
+    // and a batch's hull is its first start to its last end, as for tree 1.
+    int width = batch_width(args.layout1.max_depth, n+tile_height, args.serial_cutoff);
+    int task_counter = batch_count(child_args.size(), width);
+    vector<vector<char> > buffers;
+    int result=0;
+    if( task_counter > 0 ){
+        batch_argument_map(arg_map, child_args, width, buffers);
+        Rect<1> launch_domain(0,task_counter-1);
+        lp1 = runtime->get_logical_partition(ctx, childtree1, scratch.adopt(runtime->create_index_partition(ctx, childtree1.get_index_space(), launch_domain, batch_coloring(ranges1, width), DISJOINT_KIND)));
+        IndexPartition ip2 = scratch.adopt(runtime->create_index_partition(ctx, lr2.get_index_space(), launch_domain, batch_coloring(ranges2, width), ALIASED_KIND));
+        LogicalPartition lp2 = runtime->get_logical_partition(ctx, lr2, ip2);
+        IndexTaskLauncher product_launcher(width == 0 ? INNER_PRODUCT_MIXED_INTER_TASK_ID : SERIAL_INNER_PRODUCT_MIXED_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        product_launcher.tag = subtree_priority(min(args.layout1.max_depth, args.layout2.max_depth), n+tile_height);
+        product_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
+        product_launcher.add_region_requirement(RegionRequirement(lp2,0,READ_ONLY, EXCLUSIVE, lr2));
+        add_tree_fields(product_launcher.region_requirements[0], task, 0, width != 0);
+        add_tree_fields(product_launcher.region_requirements[1], task, 1, width != 0);
+        FutureMap f_result = execute_resident(ctx, runtime, product_launcher);
+        for( int i = 0 ; i < task_counter ; i++ )
+            result = result + f_result.get_result<int>(i);
+    }
+    result+=tile_result.get_result<int>();
+    return result;
+}
+
+InnerProductEstimate inner_product_screened_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    ScreenedArgs args = task->is_index_space ? *(const ScreenedArgs *) task->local_args
+    : *(const ScreenedArgs *) task->args;
+    int tile_height = args.layout1.tile_height;
+    tile_height = min(tile_height,args.layout1.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    LogicalRegion subtree1,childtree1;
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(args.idx,args.idx+tile_nodes-1);
+    Rect<1>tile_space = Rect<1>(0,0);
+    if(args.idx + tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(args.idx+tile_nodes,args.end_idx);
+        tile_space = Rect<1>(0,1);
+    }
+    ScratchResources scratch(ctx, runtime);
+    LogicalPartition lp1 = runtime->get_logical_partition(ctx, lr1, scratch.adopt(runtime->create_index_partition(ctx, lr1.get_index_space(), tile_space, colorStartTile, DISJOINT_KIND)));
+    subtree1 = runtime->get_logical_subregion_by_color(ctx, lp1, 0);
+    if(args.idx + tile_nodes < args.end_idx )
+        childtree1 = runtime->get_logical_subregion_by_color(ctx,lp1,1);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    TaskLauncher inner_product_intra_launcher(INNER_PRODUCT_SCREENED_INTRA_TASK_ID, TaskArgument(&args, sizeof(ScreenedArgs) ) );
+    inner_product_intra_launcher.tag = subtree_priority(min(args.layout1.max_depth, args.layout2.max_depth), n);
+    RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
+    RegionRequirement req2(tile_overlap_region(ctx, runtime, scratch, lr2, args.layout2, n, args.actual_l, tile_height), READ_ONLY, EXCLUSIVE, lr2);
+    RegionRequirement req3(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req1, task, 0);
+    add_tree_fields(req2, task, 1);
+    req3.add_field(FID_X);
+    inner_product_intra_launcher.add_region_requirement(req1);
+    inner_product_intra_launcher.add_region_requirement(req2);
+    inner_product_intra_launcher.add_region_requirement(req3);
+    Future tile_result = execute_resident(ctx, runtime, inner_product_intra_launcher);
+    ArgumentMap arg_map;
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    coord_t sub_tree_size = (1LL<<(args.layout1.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    int task_counter=0;
+    DomainPointColoring coloring1, coloring2;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
+        if(!read_acc[i].launch){
+            break;
+        }
+        int level = read_acc[i].level;
+        int nx = read_acc[i].n;
+        coord_t actual_l = read_acc[i].actual_l;
+        coord_t idx_left_sub_tree = start_idx+2*level*sub_tree_size;
+        coord_t idx_right_sub_tree = idx_left_sub_tree+sub_tree_size;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t child_idx = child == 0 ? idx_left_sub_tree : idx_right_sub_tree;
+            ScreenedArgs child_args( nx+1, 0, 2*actual_l+child, child_idx, child_idx+sub_tree_size-1, args.layout1, args.layout2, args.tolerance);
+            pair<coord_t,coord_t> range = layout_subtree_range(args.layout2, nx+1, 2*actual_l+child);
+            arg_map.set_point( task_counter , TaskArgument(&child_args,sizeof(ScreenedArgs)));
+            coloring1[task_counter] = Rect<1>(child_idx, child_idx+sub_tree_size-1);
+            coloring2[task_counter] = Rect<1>(range.first, range.second);
+            task_counter++;
+        }
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    InnerProductEstimate result = tile_result.get_result<InnerProductEstimate>();
+    if( task_counter > 0 ){
+        Rect<1> launch_domain(0,task_counter-1);
+        lp1 = runtime->get_logical_partition(ctx, childtree1, scratch.adopt(runtime->create_index_partition(ctx, childtree1.get_index_space(), launch_domain, coloring1, DISJOINT_KIND)));
+        LogicalPartition lp2 = runtime->get_logical_partition(ctx, lr2, scratch.adopt(runtime->create_index_partition(ctx, lr2.get_index_space(), launch_domain, coloring2, ALIASED_KIND)));
+        IndexTaskLauncher product_launcher(INNER_PRODUCT_SCREENED_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        product_launcher.tag = subtree_priority(min(args.layout1.max_depth, args.layout2.max_depth), n+tile_height);
+        product_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
+        product_launcher.add_region_requirement(RegionRequirement(lp2,0,READ_ONLY, EXCLUSIVE, lr2));
+        add_tree_fields(product_launcher.region_requirements[0], task, 0, false);
+        add_tree_fields(product_launcher.region_requirements[1], task, 1, false);
+        FutureMap f_result = execute_resident(ctx, runtime, product_launcher);
+        for( int i = 0 ; i < task_counter ; i++ ){
+            InnerProductEstimate child = f_result.get_result<InnerProductEstimate>(i);
+            result.estimate += child.estimate;
+            result.error_bound += child.error_bound;
+        }
+    }
+    return result;
+}
+
+// A child whose deeper input is already null has only the shallower input's
+// levels left to copy.
+MappingTagID gaxpy_priority( const MixedArgs &args ){
+    int max_depth = max(args.left_null ? 0 : args.layout1.max_depth, args.right_null ? 0 : args.layout2.max_depth);
+    return subtree_priority(max_depth, args.n);
+}
+
+// Per point, the hull of the source ranges of its children that are not
+// null on that side (an empty range marks null); a point whose children are
+// all null there gets no color.
+DomainPointColoring source_batch_coloring( const vector<pair<coord_t,coord_t> > &ranges, int width ){
+    DomainPointColoring coloring;
+    for( int i = 0 ; i < batch_count(ranges.size(), width) ; i++ ){
+        int first = width == 0 ? i : i*width;
+        int last = width == 0 ? i : min((int) ranges.size(), (i+1)*width)-1;
+        bool any = false;
+        coord_t lo = 0, hi = 0;
+        for( int j = first ; j <= last ; j++ ){
+            if( ranges[j].first > ranges[j].second )
+                continue;
+            lo = any ? min(lo, ranges[j].first) : ranges[j].first;
+            hi = any ? max(hi, ranges[j].second) : ranges[j].second;
+            any = true;
+        }
+        if( any )
+            coloring[i] = Rect<1>(lo, hi);
+    }
+    return coloring;
+}
+
+SubtreeRoot gaxpy_mixed_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    int tile_height = args.layout3.tile_height;
+    tile_height = min(tile_height,args.layout3.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    coord_t idx = args.idx;
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    LogicalRegion lr = regions[2].get_logical_region();
+    if( n == 0 )
+        store_serial_cutoff(runtime, lr.get_index_space(), args.serial_cutoff);
+    DomainPointColoring colorStartTile;
+    LogicalRegion subtree,childtree;
+    IndexSpace is = lr.get_index_space();
+    colorStartTile[0] = Rect<1>(idx,idx+tile_nodes-1);
+    Rect<1>color_space = Rect<1>(0,0);
+    if(idx+tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(idx+tile_nodes,args.end_idx);
+        color_space = Rect<1>(0,1);
+    }
+    IndexPartition ip = runtime->create_index_partition(ctx, is, color_space, colorStartTile, DISJOINT_KIND, args.layout3.partition_color);
+    LogicalPartition lp = runtime->get_logical_partition(ctx, lr, ip);
+    subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
+    if(idx+tile_nodes < args.end_idx )
+        childtree = runtime->get_logical_subregion_by_color(ctx,lp,1);
+    ScratchResources scratch(ctx, runtime);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<GaxpyHelper>(helper_Array);
+    RegionRequirement req1(tile_overlap_region(ctx, runtime, scratch, lr1, args.layout1, n, args.actual_l, tile_height), READ_ONLY, EXCLUSIVE, lr1);
+    RegionRequirement req2(tile_overlap_region(ctx, runtime, scratch, lr2, args.layout2, n, args.actual_l, tile_height), READ_ONLY, EXCLUSIVE, lr2);
+    RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
+    RegionRequirement req4(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req1, task, 0);
+    add_tree_fields(req2, task, 1);
+    add_tree_fields(req3, task, 2);
+    req4.add_field(FID_X);
+    TaskLauncher gaxpy_intra_launcher(GAXPY_MIXED_INTRA_TASK_ID, TaskArgument(&args,sizeof(MixedArgs)));
+    gaxpy_intra_launcher.tag = subtree_priority(args.layout3.max_depth, n);
+    gaxpy_intra_launcher.add_region_requirement(req1);
+    gaxpy_intra_launcher.add_region_requirement(req2);
+    gaxpy_intra_launcher.add_region_requirement(req3);
+    gaxpy_intra_launcher.add_region_requirement(req4);
+    Future tile_root = execute_resident(ctx, runtime, gaxpy_intra_launcher);
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,GaxpyHelper,1,coord_t,Realm::AffineAccessor<GaxpyHelper,1,coord_t> > read_acc(physicalRegion, FID_X);
+    coord_t sub_tree_size = (1LL<<(args.layout3.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    vector<MixedArgs>argsReqd;
+    vector<pair<coord_t,coord_t> > ranges, ranges1, ranges2;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++){
+        if(!read_acc[i].launch)
+            break;
+        int nx = read_acc[i].n;
+        int pass = read_acc[i].pass;
+        coord_t actual_l = read_acc[i].actual_l;
+        coord_t left_level = 2*read_acc[i].l;
+        coord_t right_level = left_level+1;
+        bool left_null = read_acc[i].left_null;
+        bool right_null = read_acc[i].right_null;
+        coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
+        coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t child_l = 2*actual_l+child;
+            coord_t child_idx = child ? idx_right_sub_tree : idx_left_sub_tree;
+            argsReqd.push_back(MixedArgs(nx+1, 0, child_l, child_idx, child_idx+sub_tree_size-1, args.layout1, args.layout2, args.layout3, pass, left_null, right_null));
+            argsReqd.back().multiply = args.multiply;
+            argsReqd.back().serial_cutoff = args.serial_cutoff;
+            ranges.push_back(make_pair(child_idx, child_idx+sub_tree_size-1));
+            ranges1.push_back(left_null ? make_pair((coord_t) 1, (coord_t) 0) : layout_subtree_range(args.layout1, nx+1, child_l));
+            ranges2.push_back(right_null ? make_pair((coord_t) 1, (coord_t) 0) : layout_subtree_range(args.layout2, nx+1, child_l));
+        }
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    if( argsReqd.size() == 0 )
+        return tile_root.get_result<SubtreeRoot>();
+    int width = batch_width(args.layout3.max_depth, n+tile_height, args.serial_cutoff);
+    int points = batch_count(argsReqd.size(), width);
+    Rect<1> child_space(0, points-1);
+    ip = runtime->create_index_partition(ctx, childtree.get_index_space(), child_space, batch_coloring(ranges, width), DISJOINT_KIND, args.layout3.partition_color);
+    lp = runtime->get_logical_partition(ctx, childtree, ip);
+    DomainPointColoring coloring1 = source_batch_coloring(ranges1, width);
+    DomainPointColoring coloring2 = source_batch_coloring(ranges2, width);
+    LogicalPartition lp1 = runtime->get_logical_partition(ctx, lr1, scratch.adopt(runtime->create_index_partition(ctx, lr1.get_index_space(), child_space, coloring1, ALIASED_KIND)));
+    LogicalPartition lp2 = runtime->get_logical_partition(ctx, lr2, scratch.adopt(runtime->create_index_partition(ctx, lr2.get_index_space(), child_space, coloring2, ALIASED_KIND)));
+    ArgumentMap arg_map;
+    vector<vector<char> > buffers;
+    if( width > 0 )
+        batch_argument_map(arg_map, argsReqd, width, buffers);
+    vector<Future> child_roots;
+    for( int i = 0 ; i < points ; i++ ){
+        int first = width == 0 ? i : i*width;
+        int last = width == 0 ? i : min((int) argsReqd.size(), (i+1)*width)-1;
+        TaskLauncher gaxpy_launcher(GAXPY_MIXED_INTER_TASK_ID, TaskArgument(&argsReqd[i], sizeof(MixedArgs)));
+        if( width > 0 )
+            gaxpy_launcher = TaskLauncher(SERIAL_GAXPY_MIXED_TASK_ID, TaskArgument(&buffers[i][0], buffers[i].size()));
+        MappingTagID tag = 0;
+        for( int j = first ; j <= last ; j++ )
+            tag = max(tag, gaxpy_priority(argsReqd[j]));
+        gaxpy_launcher.tag = tag;
+        // A side null for the whole point is never read; the serial task
+        // still needs an instance for it, so it gets one tile there.
+        LogicalRegion currentTile = runtime->get_logical_subregion_by_color(ctx,lp,i);
+        LogicalRegion source1 = coloring1.count(i) ? runtime->get_logical_subregion_by_color(ctx,lp1,i)
+            : width == 0 ? lr1 : tile_overlap_region(ctx, runtime, scratch, lr1, args.layout1, argsReqd[first].n, argsReqd[first].actual_l, 1);
+        LogicalRegion source2 = coloring2.count(i) ? runtime->get_logical_subregion_by_color(ctx,lp2,i)
+            : width == 0 ? lr2 : tile_overlap_region(ctx, runtime, scratch, lr2, args.layout2, argsReqd[first].n, argsReqd[first].actual_l, 1);
+        gaxpy_launcher.add_region_requirement(RegionRequirement(source1,READ_ONLY,EXCLUSIVE,lr1));
+        gaxpy_launcher.add_region_requirement(RegionRequirement(source2,READ_ONLY,EXCLUSIVE,lr2));
+        gaxpy_launcher.add_region_requirement(RegionRequirement(currentTile,WRITE_DISCARD,EXCLUSIVE,lr));
+        add_tree_fields(gaxpy_launcher.region_requirements[0], task, 0, width != 0);
+        add_tree_fields(gaxpy_launcher.region_requirements[1], task, 1, width != 0);
+        add_tree_fields(gaxpy_launcher.region_requirements[2], task, 2, width != 0);
+        child_roots.push_back(execute_resident(ctx, runtime, gaxpy_launcher));
+    }
+    return rehash_tile(ctx, runtime, task, 2, subtree, lr, TileHashArgs(args.idx, n, args.layout3.max_depth, args.layout3.tile_height, width), child_roots);
+}
+
+// One producer of accumulate: reduces the source tile's nodes into the output
+// at their positions in layout2. Only leaves carry a value; an internal node
+// only marks the output internal there.
+void accumulate_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    queue<MixedArgs>tree;
+    tree.push(args);
+    int tile_height = args.layout1.tile_height;
+    int helper_counter=0;
+    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[2], FID_X);
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], tree_field(task, 0));
+    const ReductionAccessor<TreeSumReduction,false,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], tree_field(task, 1), TREE_SUM_REDOP_ID);
+    coord_t start_idx = args.idx;
+    while(!tree.empty()){
+        MixedArgs temp = tree.front();
+        tree.pop();
+        int n = temp.n;
+        int l = temp.l;
+        coord_t actual_l = temp.actual_l;
+        coord_t idx1 = start_idx + l + (1<<(n%tile_height))-1;
+        coord_t idx2 = layout_node_index(args.layout2, n, actual_l);
+        bool is_leaf = tree1[idx1].is_leaf;
+        tree2.reduce(idx2, TreeArgs(is_leaf ? tree1[idx1].value : 0, actual_l, is_leaf));
+        if(is_leaf)
+            continue;
+        if((n% tile_height )==( tile_height-1 )){
+            helper_acc[helper_counter] = HelperArgs(l, actual_l, idx1, true, n);
+            helper_counter++;
+        }
+        else{
+            MixedArgs for_left_sub_tree (n + 1, l * 2    , 2*actual_l  , temp.idx, temp.end_idx, temp.layout1, temp.layout2);
+            MixedArgs for_right_sub_tree(n + 1, l * 2 + 1, 2*actual_l+1, temp.idx, temp.end_idx, temp.layout1, temp.layout2);
+            tree.push( for_left_sub_tree );
+            tree.push( for_right_sub_tree );
+        }
+    }
+    helper_acc[helper_counter].launch = false;
+}
+
+// Walks the source tree (layout1) tile by tile like the mixed inner product,
+// reducing into the output (layout2) with TREE_SUM_REDOP_ID. Producers with
+// the same reduction do not interfere, so every source of one accumulate runs
+// at once. The intra task reduces into the span of the tile's nodes in
+// layout2 rather than the whole subtree, which keeps its reduction instance
+// tile sized.
+void accumulate_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    MixedArgs args = task->is_index_space ? *(const MixedArgs *) task->local_args
+    : *(const MixedArgs *) task->args;
+    int tile_height = args.layout1.tile_height;
+    tile_height = min(tile_height,args.layout1.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    LogicalRegion subtree1,childtree1;
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(args.idx,args.idx+tile_nodes-1);
+    Rect<1>tile_space = Rect<1>(0,0);
+    if(args.idx + tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(args.idx+tile_nodes,args.end_idx);
+        tile_space = Rect<1>(0,1);
+    }
+    ScratchResources scratch(ctx, runtime);
+    LogicalPartition lp1 = runtime->get_logical_partition(ctx, lr1, scratch.adopt(runtime->create_index_partition(ctx, lr1.get_index_space(), tile_space, colorStartTile, DISJOINT_KIND)));
+    subtree1 = runtime->get_logical_subregion_by_color(ctx, lp1, 0);
+    if(args.idx + tile_nodes < args.end_idx )
+        childtree1 = runtime->get_logical_subregion_by_color(ctx,lp1,1);
+    coord_t first_idx2 = layout_node_index(args.layout2, n, args.actual_l), last_idx2 = first_idx2;
+    for( int k = 0 ; k < tile_height ; k++ ){
+        for( coord_t j = 0 ; j < (1<<k) ; j++ ){
+            coord_t idx2 = layout_node_index(args.layout2, n+k, ((coord_t)args.actual_l<<k)+j);
+            first_idx2 = min(first_idx2, idx2);
+            last_idx2 = max(last_idx2, idx2);
+        }
+    }
+    DomainPointColoring colorOutputTile;
+    colorOutputTile[0] = Rect<1>(first_idx2, last_idx2);
+    LogicalPartition tile_lp2 = runtime->get_logical_partition(ctx, lr2, scratch.adopt(runtime->create_index_partition(ctx, lr2.get_index_space(), Rect<1>(0,0), colorOutputTile, DISJOINT_KIND)));
+    LogicalRegion subtree2 = runtime->get_logical_subregion_by_color(ctx, tile_lp2, 0);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    TaskLauncher inner_product_intra_launcher(INNER_PRODUCT_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    TaskLauncher accumulate_intra_launcher(ACCUMULATE_INTRA_TASK_ID, TaskArgument(&args, sizeof(MixedArgs) ) );
+    accumulate_intra_launcher.tag = subtree_priority(args.layout1.max_depth, n);
     RegionRequirement req1(subtree1, READ_ONLY, EXCLUSIVE, lr1);
-    RegionRequirement req2(subtree2,READ_ONLY,EXCLUSIVE,lr2);
+    RegionRequirement req2(subtree2, TREE_SUM_REDOP_ID, EXCLUSIVE, lr2);
     RegionRequirement req3(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
-    req2.add_field(FID_X);
+    add_tree_fields(req1, task, 0);
+    add_tree_fields(req2, task, 1);
     req3.add_field(FID_X);
-    inner_product_intra_launcher.add_region_requirement(req1);
-    inner_product_intra_launcher.add_region_requirement(req2);
-    inner_product_intra_launcher.add_region_requirement(req3);
-    Future tile_result = runtime->execute_task(ctx,inner_product_intra_launcher);
+    accumulate_intra_launcher.add_region_requirement(req1);
+    accumulate_intra_launcher.add_region_requirement(req2);
+    accumulate_intra_launcher.add_region_requirement(req3);
+    execute_resident(ctx, runtime, accumulate_intra_launcher);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req3 );
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
     const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
+    coord_t sub_tree_size = (1LL<<(args.layout1.max_depth-n-tile_height))-1;
     coord_t start_idx = args.idx+tile_nodes;
     int task_counter=0;
+    DomainPointColoring coloring1, coloring2;
     for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
         if(!read_acc[i].launch){
             break;
         }
         int level = read_acc[i].level;
         int nx = read_acc[i].n;
+        coord_t actual_l = read_acc[i].actual_l;
         coord_t left_level = 2*level;
         coord_t right_level = left_level+1;
         coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
         coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
-        InnerProductArgs left_args( nx+1 , 0, args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1, args.partition_color1 , args.partition_color2, args.actual_max_depth , args.tile_height);
-        InnerProductArgs right_args( nx+1 , 0, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1 , args.partition_color1, args.partition_color2 ,args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
+        MixedArgs left_args ( nx+1, 0, 2*actual_l  , idx_left_sub_tree , idx_right_sub_tree-1, args.layout1, args.layout2);
+        MixedArgs right_args( nx+1, 0, 2*actual_l+1, idx_right_sub_tree, idx_right_sub_tree + sub_tree_size-1, args.layout1, args.layout2);
+        pair<coord_t,coord_t> left_range = layout_subtree_range(args.layout2, nx+1, 2*actual_l);
+        pair<coord_t,coord_t> right_range = layout_subtree_range(args.layout2, nx+1, 2*actual_l+1);
+        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(MixedArgs)));
+        coloring1[task_counter] = Rect<1>(idx_left_sub_tree, idx_right_sub_tree-1);
+        coloring2[task_counter] = Rect<1>(left_range.first, left_range.second);
         task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
+        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(MixedArgs)));
+        coloring1[task_counter] = Rect<1>(idx_right_sub_tree, idx_right_sub_tree + sub_tree_size-1);
+        coloring2[task_counter] = Rect<1>(right_range.first, right_range.second);
         task_counter++;
     }
-    int result=0;
+    runtime->unmap_region(ctx, physicalRegion);
     if( task_counter > 0 ){
-        lp1 = runtime->get_logical_partition_by_color(ctx,childtree1,args.partition_color1);
-        lp2 = runtime->get_logical_partition_by_color(ctx,childtree2,args.partition_color2);
         Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher product_launcher(INNER_PRODUCT_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        product_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
-        product_launcher.add_region_requirement(RegionRequirement(lp2,0,READ_ONLY, EXCLUSIVE, lr2));
-        product_launcher.add_field(0,FID_X);
-        product_launcher.add_field(1,FID_X);
-        FutureMap f_result = runtime->execute_index_space(ctx, product_launcher);
-        for( int i = 0 ; i < task_counter ; i++ )
-            result = result + f_result.get_result<int>(i);
+        lp1 = runtime->get_logical_partition(ctx, childtree1, scratch.adopt(runtime->create_index_partition(ctx, childtree1.get_index_space(), launch_domain, coloring1, DISJOINT_KIND)));
+        IndexPartition ip2 = scratch.adopt(runtime->create_index_partition(ctx, lr2.get_index_space(), launch_domain, coloring2, ALIASED_KIND));
+        LogicalPartition lp2 = runtime->get_logical_partition(ctx, lr2, ip2);
+        IndexTaskLauncher accumulate_launcher(ACCUMULATE_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        accumulate_launcher.tag = subtree_priority(args.layout1.max_depth, n+tile_height);
+        accumulate_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
+        accumulate_launcher.add_region_requirement(RegionRequirement(lp2,0,TREE_SUM_REDOP_ID, EXCLUSIVE, lr2));
+        add_tree_fields(accumulate_launcher.region_requirements[0], task, 0, false);
+        add_tree_fields(accumulate_launcher.region_requirements[1], task, 1, false);
+        execute_resident(ctx, runtime, accumulate_launcher);
+    }
+}
+
+template<typename ACC>
+void scan_tile( const ACC &acc, coord_t start, int tile_nodes, int offset, vector<char> &state, vector<int> &value ){
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        if( i > 0 && state[offset+(i-1)/2] != 1 )
+            continue;
+        state[offset+i] = acc[start+i].is_leaf ? 2 : 1;
+        value[offset+i] = acc[start+i].value;
+    }
+}
+
+// Value seen at level-k position p: the node itself, else the leaf covering
+// it, else the cover handed down for a neighbour tile that was never refined.
+int diff_lookup( const DiffArgs &args, int tile_nodes, const vector<char> &state, const vector<int> &value, int k, coord_t p ){
+    if( diff_slot(args, tile_nodes, k, p) < 0 )
+        return 0;
+    for( int kk = k ; kk >= 0 ; kk-- ){
+        int slot = diff_slot(args, tile_nodes, kk, p>>(k-kk));
+        if( state[slot] == 2 || ( kk == k && state[slot] == 1 ) )
+            return value[slot];
+    }
+    return (p>>k) < args.actual_l ? args.left_cover : args.right_cover;
+}
+
+void differentiate_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    DiffArgs args = task->is_index_space ? *(const DiffArgs *) task->local_args
+    : *(const DiffArgs *) task->args;
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > own_acc(regions[0], tree_field(task, 0));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > left_acc(regions[1], tree_field(task, 1));
+    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > right_acc(regions[2], tree_field(task, 2));
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > out_acc(regions[3], tree_field(task, 3));
+    int max_depth = args.layout.max_depth;
+    int tile_height = min(args.layout.tile_height, max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    vector<char> state(3*tile_nodes, 0);
+    vector<int> value(3*tile_nodes, 0);
+    scan_tile(own_acc, args.idx, tile_nodes, tile_nodes, state, value);
+    if( args.left_exists )
+        scan_tile(left_acc, layout_node_index(args.layout, args.n, args.actual_l-1), tile_nodes, 0, state, value);
+    if( args.right_exists )
+        scan_tile(right_acc, layout_node_index(args.layout, args.n, args.actual_l+1), tile_nodes, 2*tile_nodes, state, value);
+    vector<DiffArgs> launch_entries;
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        if( state[tile_nodes+i] == 0 )
+            continue;
+        int k = 31 - __builtin_clz(i+1);
+        coord_t j = i - ((1<<k)-1);
+        coord_t p = (args.actual_l<<k) + j;
+        int derivative = ( diff_lookup(args, tile_nodes, state, value, k, p+1) - diff_lookup(args, tile_nodes, state, value, k, p-1) )/2;
+        out_acc[args.idx+i] = TreeArgs(derivative, p, state[tile_nodes+i] == 2);
+        if( k != tile_height-1 || state[tile_nodes+i] != 1 || args.n+tile_height >= max_depth )
+            continue;
+        coord_t sub_tree_size = (1LL<<(max_depth-args.n-tile_height))-1;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t q = 2*p+child;
+            coord_t child_idx = child_tile_start(args.idx, tile_height, max_depth, args.n+k, j, child);
+            DiffArgs child_args(args.n+tile_height, q, child_idx, child_idx+sub_tree_size-1, args.layout);
+            int left_slot = diff_slot(args, tile_nodes, k, (q-1)>>1);
+            int right_slot = diff_slot(args, tile_nodes, k, (q+1)>>1);
+            child_args.left_exists = q > 0 && left_slot >= 0 && state[left_slot] == 1;
+            child_args.right_exists = right_slot >= 0 && state[right_slot] == 1;
+            if( !child_args.left_exists && q > 0 )
+                child_args.left_cover = diff_lookup(args, tile_nodes, state, value, k, (q-1)>>1);
+            if( !child_args.right_exists )
+                child_args.right_cover = diff_lookup(args, tile_nodes, state, value, k, (q+1)>>1);
+            launch_entries.push_back(child_args);
+        }
+    }
+    write_launch_entries(regions[4], launch_entries);
+}
+
+void differentiate_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    DiffArgs args = task->is_index_space ? *(const DiffArgs *) task->local_args
+    : *(const DiffArgs *) task->args;
+    int tile_height = min(args.layout.tile_height, args.layout.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    coord_t idx = args.idx;
+    LogicalRegion lr_in = regions[0].get_logical_region();
+    LogicalRegion lr = regions[1].get_logical_region();
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(idx,idx+tile_nodes-1);
+    Rect<1>color_space = Rect<1>(0,0);
+    if(idx+tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(idx+tile_nodes,args.end_idx);
+        color_space = Rect<1>(0,1);
+    }
+    IndexPartition ip = runtime->create_index_partition(ctx, lr.get_index_space(), color_space, colorStartTile, DISJOINT_KIND, args.layout.partition_color);
+    LogicalPartition lp = runtime->get_logical_partition(ctx, lr, ip);
+    LogicalRegion subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
+    LogicalRegion childtree;
+    if(idx+tile_nodes < args.end_idx )
+        childtree = runtime->get_logical_subregion_by_color(ctx, lp, 1);
+    // Ghost partition: the tile itself plus the same-level tile on either
+    // side, so the intra task receives its whole halo as two tile copies.
+    coord_t left_start = args.left_exists ? layout_node_index(args.layout, args.n, args.actual_l-1) : idx;
+    coord_t right_start = args.right_exists ? layout_node_index(args.layout, args.n, args.actual_l+1) : idx;
+    DomainPointColoring ghost_coloring;
+    ghost_coloring[0] = Rect<1>(idx, idx+tile_nodes-1);
+    ghost_coloring[1] = Rect<1>(left_start, left_start+tile_nodes-1);
+    ghost_coloring[2] = Rect<1>(right_start, right_start+tile_nodes-1);
+    ScratchResources scratch(ctx, runtime);
+    IndexPartition ghost_ip = scratch.adopt(runtime->create_index_partition(ctx, lr_in.get_index_space(), Rect<1>(0,2), ghost_coloring, ALIASED_KIND));
+    LogicalPartition ghost_lp = runtime->get_logical_partition(ctx, lr_in, ghost_ip);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height)));
+    LogicalRegion new_helper_Region = scratch.create_region<DiffArgs>(helper_Array);
+    TaskLauncher diff_intra_launcher(DIFFERENTIATE_INTRA_TASK_ID, TaskArgument(&args, sizeof(DiffArgs)));
+    diff_intra_launcher.tag = subtree_priority(args.layout.max_depth, args.n);
+    for( int ghost = 0 ; ghost < 3 ; ghost++ ){
+        RegionRequirement req(runtime->get_logical_subregion_by_color(ctx, ghost_lp, ghost), READ_ONLY, EXCLUSIVE, lr_in);
+        add_tree_fields(req, task, 0);
+        diff_intra_launcher.add_region_requirement(req);
+    }
+    RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
+    RegionRequirement req4(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req3, task, 1);
+    req4.add_field(FID_X);
+    diff_intra_launcher.add_region_requirement(req3);
+    diff_intra_launcher.add_region_requirement(req4);
+    execute_resident(ctx, runtime, diff_intra_launcher);
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,DiffArgs,1,coord_t,Realm::AffineAccessor<DiffArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    ArgumentMap arg_map;
+    DomainPointColoring coloring;
+    int task_counter=0;
+    for( int i = 0 ; i < (1<<tile_height) ; i++ ){
+        if(!read_acc[i].launch)
+            break;
+        DiffArgs child_args = read_acc[i];
+        arg_map.set_point(task_counter, TaskArgument(&child_args, sizeof(DiffArgs)));
+        coloring[task_counter] = Rect<1>(child_args.idx, child_args.end_idx);
+        task_counter++;
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    if( task_counter > 0 ){
+        Rect<1> launch_domain(0,task_counter-1);
+        ip = runtime->create_index_partition(ctx, childtree.get_index_space(), launch_domain, coloring, DISJOINT_KIND, args.layout.partition_color);
+        lp = runtime->get_logical_partition(ctx, childtree, ip);
+        IndexTaskLauncher diff_launcher(DIFFERENTIATE_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        diff_launcher.tag = subtree_priority(args.layout.max_depth, args.n+tile_height);
+        RegionRequirement input_req(lr_in, READ_ONLY, EXCLUSIVE, lr_in);
+        add_tree_fields(input_req, task, 0, false);
+        diff_launcher.add_region_requirement(input_req);
+        diff_launcher.add_region_requirement(RegionRequirement(lp, 0, WRITE_DISCARD, EXCLUSIVE, lr));
+        add_tree_fields(diff_launcher.region_requirements[1], task, 1, false);
+        execute_resident(ctx, runtime, diff_launcher);
+    }
+}
+
+void apply_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<ApplySource> sources;
+    ApplyArgs args = unpack_apply_args(task, sources);
+    int max_depth = args.layout.max_depth;
+    int tile_height = min(args.layout.tile_height, max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int count = sources.size();
+    vector<char> state(count*tile_nodes, 0);
+    vector<int> value(count*tile_nodes, 0);
+    for( int s = 0 ; s < count ; s++ ){
+        const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > source_acc(regions[s], tree_field(task, s));
+        scan_tile(source_acc, layout_node_index(args.layout, args.n, sources[s].l), tile_nodes, s*tile_nodes, state, value);
+    }
+    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > out_acc(regions[count], tree_field(task, count));
+    vector<ApplyCandidate> launch_entries;
+    int child_counter=0;
+    for( int i = 0 ; i < tile_nodes ; i++ ){
+        if( state[i] == 0 )
+            continue;
+        int k = 31 - __builtin_clz(i+1);
+        coord_t j = i - ((1<<k)-1);
+        coord_t p = (args.target_l<<k) + j;
+        int result=0;
+        for( int s = 0 ; s < count ; s++ ){
+            for( int i2 = (1<<k)-1 ; i2 < (1<<(k+1))-1 ; i2++ ){
+                if( state[s*tile_nodes+i2] == 0 )
+                    continue;
+                coord_t p2 = (sources[s].l<<k) + i2-((1<<k)-1);
+                result += apply_kernel(value[s*tile_nodes+i2], abs(p-p2));
+            }
+        }
+        out_acc[args.idx+i] = TreeArgs(result, p, state[i] == 2);
+        if( k != tile_height-1 || state[i] != 1 || args.n+tile_height >= max_depth )
+            continue;
+        coord_t sub_tree_size = (1LL<<(max_depth-args.n-tile_height))-1;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t q = 2*p+child;
+            coord_t child_idx = child_tile_start(args.idx, tile_height, max_depth, args.n+k, j, child);
+            launch_entries.push_back(ApplyCandidate(child_counter, q, child_idx, child_idx+sub_tree_size-1, ApplySource(q, value[i])));
+            for( int s = 0 ; s < count ; s++ ){
+                for( int i2 = (1<<k)-1 ; i2 < tile_nodes ; i2++ ){
+                    if( state[s*tile_nodes+i2] != 1 )
+                        continue;
+                    coord_t r = (sources[s].l<<k) + i2-((1<<k)-1);
+                    for( int child2 = 0 ; child2 < 2 ; child2++ ){
+                        coord_t q2 = 2*r+child2;
+                        if( q2 == q || apply_screened(value[s*tile_nodes+i2], abs(q-q2), args.tolerance) )
+                            continue;
+                        launch_entries.push_back(ApplyCandidate(child_counter, q, child_idx, child_idx+sub_tree_size-1, ApplySource(q2, value[s*tile_nodes+i2])));
+                    }
+                }
+            }
+            child_counter++;
+        }
+    }
+    write_launch_entries(regions[count+1], launch_entries);
+}
+
+void apply_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    vector<ApplySource> sources;
+    ApplyArgs args = unpack_apply_args(task, sources);
+    int tile_height = min(args.layout.tile_height, args.layout.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    coord_t idx = args.idx;
+    LogicalRegion lr_in = regions[0].get_logical_region();
+    LogicalRegion lr = regions[1].get_logical_region();
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(idx,idx+tile_nodes-1);
+    Rect<1>color_space = Rect<1>(0,0);
+    if(idx+tile_nodes < args.end_idx ){
+        colorStartTile[1] = Rect<1>(idx+tile_nodes,args.end_idx);
+        color_space = Rect<1>(0,1);
+    }
+    IndexPartition ip = runtime->create_index_partition(ctx, lr.get_index_space(), color_space, colorStartTile, DISJOINT_KIND, args.layout.partition_color);
+    LogicalPartition lp = runtime->get_logical_partition(ctx, lr, ip);
+    LogicalRegion subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
+    LogicalRegion childtree;
+    if(idx+tile_nodes < args.end_idx )
+        childtree = runtime->get_logical_subregion_by_color(ctx, lp, 1);
+    // One aliased piece per surviving source tile; the target's own input
+    // tile is always source 0.
+    DomainPointColoring source_coloring;
+    for( size_t s = 0 ; s < sources.size() ; s++ ){
+        coord_t start = layout_node_index(args.layout, args.n, sources[s].l);
+        source_coloring[s] = Rect<1>(start, start+tile_nodes-1);
+    }
+    ScratchResources scratch(ctx, runtime);
+    IndexPartition source_ip = scratch.adopt(runtime->create_index_partition(ctx, lr_in.get_index_space(), Rect<1>(0,sources.size()-1), source_coloring, ALIASED_KIND));
+    LogicalPartition source_lp = runtime->get_logical_partition(ctx, lr_in, source_ip);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>((1LL<<(2*tile_height))*sources.size()));
+    LogicalRegion new_helper_Region = scratch.create_region<ApplyCandidate>(helper_Array);
+    vector<char> buffer = pack_apply_args(args, sources);
+    TaskLauncher apply_intra_launcher(APPLY_INTRA_TASK_ID, TaskArgument(&buffer[0], buffer.size()));
+    apply_intra_launcher.tag = subtree_priority(args.layout.max_depth, args.n);
+    for( size_t s = 0 ; s < sources.size() ; s++ ){
+        RegionRequirement req(runtime->get_logical_subregion_by_color(ctx, source_lp, s), READ_ONLY, EXCLUSIVE, lr_in);
+        add_tree_fields(req, task, 0);
+        apply_intra_launcher.add_region_requirement(req);
+    }
+    RegionRequirement req3(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
+    RegionRequirement req4(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req3, task, 1);
+    req4.add_field(FID_X);
+    apply_intra_launcher.add_region_requirement(req3);
+    apply_intra_launcher.add_region_requirement(req4);
+    execute_resident(ctx, runtime, apply_intra_launcher);
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,ApplyCandidate,1,coord_t,Realm::AffineAccessor<ApplyCandidate,1,coord_t> > read_acc(physicalRegion, FID_X);
+    vector<ApplyArgs> child_args;
+    vector<vector<ApplySource> > child_sources;
+    DomainPointColoring coloring;
+    for( coord_t i = 0 ; read_acc[i].launch ; i++ ){
+        ApplyCandidate candidate = read_acc[i];
+        if( candidate.child == (int) child_args.size() ){
+            child_args.push_back(ApplyArgs(args.n+tile_height, candidate.target_l, candidate.idx, candidate.end_idx, args.layout, args.tolerance));
+            child_sources.push_back(vector<ApplySource>());
+            coloring[candidate.child] = Rect<1>(candidate.idx, candidate.end_idx);
+        }
+        child_sources[candidate.child].push_back(candidate.source);
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    if( child_args.size() > 0 ){
+        Rect<1> launch_domain(0,child_args.size()-1);
+        ip = runtime->create_index_partition(ctx, childtree.get_index_space(), launch_domain, coloring, DISJOINT_KIND, args.layout.partition_color);
+        lp = runtime->get_logical_partition(ctx, childtree, ip);
+        ArgumentMap arg_map;
+        vector<vector<char> > buffers(child_args.size());
+        for( size_t i = 0 ; i < child_args.size() ; i++ ){
+            buffers[i] = pack_apply_args(child_args[i], child_sources[i]);
+            arg_map.set_point(i, TaskArgument(&buffers[i][0], buffers[i].size()));
+        }
+        IndexTaskLauncher apply_launcher(APPLY_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        apply_launcher.tag = subtree_priority(args.layout.max_depth, args.n+tile_height);
+        RegionRequirement input_req(lr_in, READ_ONLY, EXCLUSIVE, lr_in);
+        add_tree_fields(input_req, task, 0, false);
+        apply_launcher.add_region_requirement(input_req);
+        apply_launcher.add_region_requirement(RegionRequirement(lp, 0, WRITE_DISCARD, EXCLUSIVE, lr));
+        add_tree_fields(apply_launcher.region_requirements[1], task, 1, false);
+        execute_resident(ctx, runtime, apply_launcher);
     }
-    result+=tile_result.get_result<int>();
-    return result;
 }
 
 int norm_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
@@ -1020,65 +4803,79 @@ int norm_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions
     else{
         subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
     }
+    ScratchResources scratch(ctx, runtime);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    args.memoize = true;
     TaskLauncher norm_intra_launcher(NORM_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    norm_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
     RegionRequirement req1(subtree, READ_ONLY, EXCLUSIVE, lr);
     RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
+    add_tree_fields(req1, task, 0);
     req2.add_field(FID_X);
     norm_intra_launcher.add_region_requirement(req1);
     norm_intra_launcher.add_region_requirement(req2);
-    Future tile_result = runtime->execute_task(ctx,norm_intra_launcher);
+    Future tile_result = execute_resident(ctx, runtime, norm_intra_launcher, !args.prefetch || n == 0);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
-    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
     coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
     coord_t start_idx = args.idx+tile_nodes;
-    int task_counter=0;
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    if( args.prefetch && width == 0 && args.idx + tile_nodes < args.end_idx )
+        prefetch_child_tiles(ctx, runtime, scratch, childtree, lr, tree_field(task, 0), start_idx, sub_tree_size, tile_height, min(args.tile_height, args.max_depth-n-tile_height));
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    vector<Arguments> child_args;
+    vector<TaskPriority> priorities;
     for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
         if(!read_acc[i].launch){
             break;
         }
         int level = read_acc[i].level;
         int nx = read_acc[i].n;
-        int actual_l = read_acc[i].actual_l;
+        coord_t actual_l = read_acc[i].actual_l;
         coord_t left_level = 2*level;
         coord_t right_level = left_level+1;
         coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
         coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
         Arguments left_args( nx+1,0 ,2*actual_l ,args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1 ,args.partition_color , args.actual_max_depth, args.tile_height);
         Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
+        left_args.prefetch = args.prefetch;
+        right_args.prefetch = args.prefetch;
+        child_args.push_back(left_args);
+        child_args.push_back(right_args);
+        priorities.insert(priorities.end(), 2, child_priority(args.max_depth, nx+1, read_acc[i].height));
     }
+    runtime->unmap_region(ctx, physicalRegion);
     FutureMap child_result;
+    int task_counter = batch_count(child_args.size(), width);
+    vector<vector<char> > buffers;
     if( task_counter > 0 ){
+        batch_argument_map(arg_map, child_args, width, buffers, &priorities);
         lp = runtime->get_logical_partition_by_color(ctx,childtree,args.partition_color);
         Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher norm_launcher(NORM_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        norm_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        norm_launcher.add_field(0, FID_X);
-        child_result =runtime->execute_index_space(ctx, norm_launcher);
+        IndexTaskLauncher norm_launcher(width == 0 ? NORM_INTER_TASK_ID : SERIAL_NORM_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        norm_launcher.tag = subtree_priority(args.max_depth, n+tile_height) | POINT_PRIORITY_TAG;
+        norm_launcher.add_region_requirement(RegionRequirement(lp,0,READ_ONLY, EXCLUSIVE, lr));
+        add_tree_fields(norm_launcher.region_requirements[0], task, 0, width != 0);
+        child_result =execute_resident(ctx, runtime, norm_launcher);
     }
-    int result=tile_result.get_result<int>();
+    TileProduct tile = tile_result.get_result<TileProduct>();
+    int result=tile.value;
     for( int i = 0 ; i < task_counter; i++ )
         result+=child_result.get_result<int>(i);
+    if( !tile.cached )
+        store_product(tile.hash1, tile.hash2, result);
     return result;
 }
 
 
-void reconstruct_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+SubtreeRoot reconstruct_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
@@ -1093,35 +4890,32 @@ void reconstruct_inter_task(const Task *task, const std::vector<PhysicalRegion>
     else{
         subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
     }
+    ScratchResources scratch(ctx, runtime);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
     TaskLauncher reconstruct_intra_launcher(RECONSTRUCT_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
-    RegionRequirement req1(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
+    reconstruct_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
+    RegionRequirement req1(subtree, READ_WRITE, EXCLUSIVE, lr);
     RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
+    add_tree_fields(req1, task, 0);
     req2.add_field(FID_X);
     reconstruct_intra_launcher.add_region_requirement(req1);
     reconstruct_intra_launcher.add_region_requirement(req2);
-    runtime->execute_task(ctx,reconstruct_intra_launcher);
+    Future tile_root = execute_resident(ctx, runtime, reconstruct_intra_launcher);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
     const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
     coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
     coord_t start_idx = args.idx+tile_nodes;
-    int task_counter=0;
+    vector<Arguments> child_args;
+    vector<TaskPriority> priorities;
     for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
         if(!read_acc[i].launch){
             break;
         }
         int level = read_acc[i].level;
         int nx = read_acc[i].n;
-        int actual_l = read_acc[i].actual_l;
+        coord_t actual_l = read_acc[i].actual_l;
         int carry = read_acc[i].carry;
         coord_t left_level = 2*level;
         coord_t right_level = left_level+1;
@@ -1131,31 +4925,41 @@ void reconstruct_inter_task(const Task *task, const std::vector<PhysicalRegion>
         left_args.carry=carry;
         Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height);
         right_args.carry=carry;
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
+        child_args.push_back(left_args);
+        child_args.push_back(right_args);
+        priorities.insert(priorities.end(), 2, child_priority(args.max_depth, nx+1, read_acc[i].height));
     }
+    runtime->unmap_region(ctx, physicalRegion);
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    int task_counter = batch_count(child_args.size(), width);
+    vector<vector<char> > buffers;
     if( task_counter > 0 ){
+        batch_argument_map(arg_map, child_args, width, buffers, &priorities);
         lp = runtime->get_logical_partition_by_color(ctx,childtree,args.partition_color);
         Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        reconstruct_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        reconstruct_launcher.add_field(0, FID_X);
-        runtime->execute_index_space(ctx, reconstruct_launcher);
+        IndexTaskLauncher reconstruct_launcher(width == 0 ? RECONSTRUCT_INTER_TASK_ID : SERIAL_RECONSTRUCT_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        reconstruct_launcher.tag = subtree_priority(args.max_depth, n+tile_height) | POINT_PRIORITY_TAG;
+        reconstruct_launcher.add_region_requirement(RegionRequirement(lp,0,READ_WRITE, EXCLUSIVE, lr));
+        add_tree_fields(reconstruct_launcher.region_requirements[0], task, 0, width != 0);
+        FutureMap child_roots = execute_resident(ctx, runtime, reconstruct_launcher);
+        return rehash_tile(ctx, runtime, task, 0, subtree, lr, TileHashArgs(args.idx, n, args.max_depth, args.tile_height, width), point_futures(child_roots, task_counter));
     }
+    return tile_root.get_result<SubtreeRoot>();
 }
 
 
-void compress_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+RootPosArgs compress_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
     int n = args.n;
     LogicalRegion lr = regions[0].get_logical_region();
-    LogicalRegion root_locate, root_locate_region;
     LogicalPartition lp = runtime->get_logical_partition_by_color(ctx,lr,args.partition_color);
     LogicalRegion subtree,childtree;
     if(args.idx+tile_nodes < args.end_idx ){
@@ -1165,27 +4969,23 @@ void compress_inter_task(const Task *task, const std::vector<PhysicalRegion> &re
     else{
         subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);   
     }
-    root_locate = regions[1].get_logical_region();
+    ScratchResources scratch(ctx, runtime);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
     TaskLauncher compress_intra_launcher(COMPRESS_INTRA_TASK_ID, TaskArgument(&args,sizeof(Arguments)));
-    RegionRequirement req1(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
+    compress_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
+    RegionRequirement req1(subtree, READ_ONLY, EXCLUSIVE, lr);
     RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
+    add_tree_fields(req1, task, 0);
     req2.add_field(FID_X);
     compress_intra_launcher.add_region_requirement(req1);
     compress_intra_launcher.add_region_requirement(req2);
-    runtime->execute_task(ctx,compress_intra_launcher);
+    execute_resident(ctx, runtime, compress_intra_launcher);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
     const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    int task_counter=0;
+    vector<Arguments> child_args;
+    vector<TaskPriority> priorities;
     coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
     coord_t start_idx = args.idx+tile_nodes;
     for( int  i = 0 ; i < (1<<tile_height) ; i++){
@@ -1195,85 +4995,308 @@ void compress_inter_task(const Task *task, const std::vector<PhysicalRegion> &re
         if( launch ){
             int level = read_acc[i].level;
             int nx = read_acc[i].n;
-            int actual_l = read_acc[i].actual_l;
+            coord_t actual_l = read_acc[i].actual_l;
             coord_t left_level = 2*level;
             coord_t right_level = left_level+1;
             coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
             coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
-            Arguments left_args( nx+1,0 ,2*actual_l ,args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1 ,args.partition_color , args.actual_max_depth , args.tile_height,task_counter);
-            arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-            task_counter++;
-            Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height,task_counter);
-            arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-            task_counter++;
+            Arguments left_args( nx+1,0 ,2*actual_l ,args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1 ,args.partition_color , args.actual_max_depth , args.tile_height);
+            left_args.serial_cutoff = args.serial_cutoff;
+            child_args.push_back(left_args);
+            Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height);
+            right_args.serial_cutoff = args.serial_cutoff;
+            child_args.push_back(right_args);
+            priorities.insert(priorities.end(), 2, child_priority(args.max_depth, nx+1, read_acc[i].height));
         }
     }
+    runtime->unmap_region(ctx, physicalRegion);
+    int task_counter = child_args.size();
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    int points = batch_count(task_counter, width);
+    vector<vector<char> > buffers;
+    batch_argument_map(arg_map, child_args, width, buffers, &priorities);
 
+    TaskLauncher compress_update_launcher(COMPRESS_UPDATE_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+    compress_update_launcher.tag = subtree_priority(args.max_depth, args.n);
     if( task_counter > 0 ){
-        Rect<1> root_location(0, task_counter-1);
-        is = runtime->create_index_space(ctx, root_location);
-        fs = runtime->create_field_space(ctx);
-        {
-            FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-            allocator.allocate_field(sizeof(RootPosArgs), FID_X);
-        }
-        root_locate_region = runtime->create_logical_region(ctx, is, fs);
         lp = runtime->get_logical_partition_by_color(ctx,childtree,args.partition_color);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher compress_launcher(COMPRESS_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        compress_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        IndexSpace is2 = root_locate_region.get_index_space();
-        DomainPointColoring coloring;
-        for( int i = 0 ; i < task_counter ; i++ ){
-            coloring[i]= Rect<1>(i,i);
-        }
-        Rect<1>color_space = Rect<1>(0,task_counter-1);
-        IndexPartition ip2 = runtime->create_index_partition(ctx, is2, color_space, coloring, DISJOINT_KIND, args.partition_color);
-        LogicalPartition lp2 = runtime->get_logical_partition(ctx, root_locate_region, ip2);
-        compress_launcher.add_region_requirement(RegionRequirement(lp2,0,WRITE_DISCARD,EXCLUSIVE,root_locate_region));
-        compress_launcher.add_field(0, FID_X);
-        compress_launcher.add_field(1,FID_X);
-        runtime->execute_index_space(ctx, compress_launcher);
-    }
-    if(task_counter == 0 ){
-            Rect<1> root_location(0, 0);
-            is = runtime->create_index_space(ctx, root_location);
-            fs = runtime->create_field_space(ctx);
-            {
-                FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-                allocator.allocate_field(sizeof(RootPosArgs), FID_X);
-            }
-            root_locate_region = runtime->create_logical_region(ctx, is, fs);
+        Rect<1> launch_domain(0,points-1);
+        IndexTaskLauncher compress_launcher(width == 0 ? COMPRESS_INTER_TASK_ID : SERIAL_COMPRESS_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        compress_launcher.tag = subtree_priority(args.max_depth, n+tile_height) | POINT_PRIORITY_TAG;
+        compress_launcher.add_region_requirement(RegionRequirement(lp,0,READ_WRITE, EXCLUSIVE, lr));
+        add_tree_fields(compress_launcher.region_requirements[0], task, 0, width != 0);
+        FutureMap child_result = execute_resident(ctx, runtime, compress_launcher);
+        for( int i = 0 ; i < points ; i++ )
+            compress_update_launcher.add_future(child_result.get_future(i));
     }
-    args.actual_max_depth = task_counter-1;
-    TaskLauncher compress_update_launcher(COMPRESS_UPDATE_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
-    RegionRequirement req4(subtree,WRITE_DISCARD,EXCLUSIVE,lr);
+    RegionRequirement req4(subtree,READ_WRITE,EXCLUSIVE,lr);
     RegionRequirement req5(new_helper_Region,READ_ONLY,EXCLUSIVE,new_helper_Region);
-    RegionRequirement req6( root_locate_region , WRITE_DISCARD, EXCLUSIVE, root_locate_region );
-    RegionRequirement req7( root_locate, WRITE_DISCARD, EXCLUSIVE, root_locate );
-    req4.add_field(FID_X);
+    add_tree_fields(req4, task, 0);
     req5.add_field(FID_X);
-    req6.add_field(FID_X);
-    req7.add_field(FID_X);
     compress_update_launcher.add_region_requirement( req4 );
     compress_update_launcher.add_region_requirement( req5 );
-    compress_update_launcher.add_region_requirement( req6 );
-    compress_update_launcher.add_region_requirement( req7 );
-    runtime->execute_task(ctx, compress_update_launcher);
+    return execute_resident(ctx, runtime, compress_update_launcher).get_result<RootPosArgs>();
+}
 
+// Replaces the partitions of the subtree at args in region lr, whose tile
+// partition is tile_lp, with ones built from the tree as it is now. parent
+// is the calling task's region holding lr.
+void rebuild_partitions( Context ctx, HighLevelRuntime *runtime, const Task *task, LogicalRegion lr, LogicalRegion parent, LogicalPartition tile_lp, const Arguments &args ){
+    runtime->destroy_index_partition(ctx, tile_lp.get_index_partition());
+    TaskLauncher partition_launcher(PARTITION_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+    partition_launcher.tag = subtree_priority(args.max_depth, args.n);
+    partition_launcher.add_region_requirement(RegionRequirement(lr, READ_ONLY, EXCLUSIVE, parent));
+    add_tree_fields(partition_launcher.region_requirements[0], task, 0, false);
+    execute_resident(ctx, runtime, partition_launcher);
 }
 
-void refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    
+TruncateResult truncate_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    if( args.n == 0 )
+        args.serial_cutoff = stored_serial_cutoff(runtime, task);
+    int tile_height = args.tile_height;
+    tile_height = min(tile_height,args.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    LogicalRegion lr = regions[0].get_logical_region();
+    LogicalPartition tile_lp = runtime->get_logical_partition_by_color(ctx,lr,args.partition_color);
+    LogicalPartition lp = tile_lp;
+    LogicalRegion subtree,childtree;
+    if( args.idx + tile_nodes < args.end_idx ){
+        subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
+        childtree = runtime->get_logical_subregion_by_color(ctx,lp,1);
+    }
+    else{
+        subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
+    }
+    ScratchResources scratch(ctx, runtime);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    TaskLauncher scan_intra_launcher(NORM_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    scan_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
+    RegionRequirement req1(subtree, READ_ONLY, EXCLUSIVE, lr);
+    RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    add_tree_fields(req1, task, 0);
+    req2.add_field(FID_X);
+    scan_intra_launcher.add_region_requirement(req1);
+    scan_intra_launcher.add_region_requirement(req2);
+    execute_resident(ctx, runtime, scan_intra_launcher);
+    ArgumentMap arg_map;
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    vector<Arguments> child_args;
+    vector<TaskPriority> priorities;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
+        if(!read_acc[i].launch){
+            break;
+        }
+        int level = read_acc[i].level;
+        int nx = read_acc[i].n;
+        coord_t actual_l = read_acc[i].actual_l;
+        coord_t left_level = 2*level;
+        coord_t right_level = left_level+1;
+        coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
+        coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
+        Arguments left_args( nx+1,0 ,2*actual_l ,args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1 ,args.partition_color , args.actual_max_depth, args.tile_height);
+        Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height);
+        left_args.tolerance = args.tolerance;
+        right_args.tolerance = args.tolerance;
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
+        child_args.push_back(left_args);
+        child_args.push_back(right_args);
+        priorities.insert(priorities.end(), 2, child_priority(args.max_depth, nx+1, read_acc[i].height));
+    }
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    int task_counter = batch_count(child_args.size(), width);
+    vector<vector<char> > buffers;
+    batch_argument_map(arg_map, child_args, width, buffers, &priorities);
+    runtime->unmap_region(ctx, physicalRegion);
+    TaskLauncher truncate_update_launcher(TRUNCATE_UPDATE_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+    truncate_update_launcher.tag = subtree_priority(args.max_depth, args.n);
+    FutureMap child_result;
+    if( task_counter > 0 ){
+        lp = runtime->get_logical_partition_by_color(ctx,childtree,args.partition_color);
+        Rect<1> launch_domain(0,task_counter-1);
+        IndexTaskLauncher truncate_launcher(width == 0 ? TRUNCATE_INTER_TASK_ID : SERIAL_TRUNCATE_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        truncate_launcher.tag = subtree_priority(args.max_depth, n+tile_height) | POINT_PRIORITY_TAG;
+        truncate_launcher.add_region_requirement(RegionRequirement(lp,0,READ_WRITE, EXCLUSIVE, lr));
+        add_tree_fields(truncate_launcher.region_requirements[0], task, 0, width != 0);
+        child_result = execute_resident(ctx, runtime, truncate_launcher);
+        for( int i = 0 ; i < task_counter ; i++ )
+            truncate_update_launcher.add_future(child_result.get_future(i));
+    }
+    RegionRequirement req3(subtree, READ_WRITE, EXCLUSIVE, lr);
+    add_tree_fields(req3, task, 0);
+    truncate_update_launcher.add_region_requirement(req3);
+    TruncateResult result = execute_resident(ctx, runtime, truncate_update_launcher).get_result<TruncateResult>();
+    // A reshaped tile's partitions are rebuilt by whoever holds the region
+    // they hang from: the parent for a child, the root for itself. Only the
+    // topmost reshaped tile of a subtree rebuilds, since destroying its
+    // partitions takes every partition below it along. Serial batches have
+    // none to rebuild. The collapsed subtrees' slots stay allocated; tiles
+    // sit at fixed positions, so the region is never compacted.
+    if( result.reshaped ){
+        if( args.n == 0 )
+            rebuild_partitions(ctx, runtime, task, lr, lr, tile_lp, args);
+        return result;
+    }
+    if( task_counter > 0 && width == 0 ){
+        for( int i = 0 ; i < task_counter ; i++ ){
+            if( !child_result.get_result<TruncateResult>(i).reshaped )
+                continue;
+            LogicalRegion child = runtime->get_logical_subregion_by_color(ctx, lp, i);
+            rebuild_partitions(ctx, runtime, task, child, lr, runtime->get_logical_partition_by_color(ctx, child, args.partition_color), child_args[i]);
+        }
+    }
+    return result;
+}
+
+// Mapping the tile is the whole job: prefetch_child_tiles has acquired it, so
+// the mapping copies it out of the tree's file into memory, where the child
+// inter task's intra launch finds it valid.
+void prefetch_tile_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+}
+
+// See rehash_tile; every field of the tile is rehashed.
+SubtreeRoot hash_tile_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    TileHashArgs args = *(const TileHashArgs *) task->args;
+    const set<FieldID> &fields = task->regions[0].privilege_fields;
+    SubtreeRoot result;
+    int field = 0;
+    for( set<FieldID>::const_iterator it = fields.begin() ; it != fields.end() ; ++it, field++ ){
+        const FieldAccessor<READ_WRITE,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], *it);
+        vector<TreeArgs> child_roots;
+        for( size_t c = 0 ; c < task->futures.size() ; c++ ){
+            if( args.width == 0 ){
+                child_roots.push_back(task->futures[c].get_result<SubtreeRoot>().node(field));
+                continue;
+            }
+            SubtreeRootBatch batch = task->futures[c].get_result<SubtreeRootBatch>();
+            for( int m = 0 ; m < batch.count ; m++ )
+                child_roots.push_back(batch.member[m].node(field));
+        }
+        size_t next_child = 0;
+        hash_subtree(tree_acc, args.idx, args.n, 0, args.max_depth, args.tile_height, &child_roots, &next_child);
+        result.add(tree_acc, args.idx);
+    }
+    return result;
+}
+
+// 1 when the two trees hold the same contents, 0 when they differ, -1 when
+// either root hash is stale. Only the root tiles are mapped.
+int same_tree_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const Color *partition_colors = (const Color *) task->args;
+    unsigned long long hashes[2];
+    for( int k = 0 ; k < 2 ; k++ ){
+        LogicalRegion lr = regions[k].get_logical_region();
+        LogicalRegion root_tile = runtime->get_logical_subregion_by_color(ctx, runtime->get_logical_partition_by_color(ctx, lr, partition_colors[k]), 0);
+        RegionRequirement req(root_tile, READ_ONLY, EXCLUSIVE, lr);
+        req.add_field(tree_field(task, k));
+        PhysicalRegion root = runtime->map_region(ctx, req);
+        const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(root, tree_field(task, k));
+        hashes[k] = subtree_hash(tree_acc[0]);
+        runtime->unmap_region(ctx, root);
+    }
+    if( hashes[0] == 0 || hashes[1] == 0 )
+        return -1;
+    return hashes[0] == hashes[1] ? 1 : 0;
+}
+
+// Gives a tree whose nodes were written without going through refine
+// (accumulate, truncate, a reshaping copy) the tile partitions the inter tasks
+// expect. Like refine it partitions on the way down, one task per tile: the
+// tile's scan writes its child ranges and the child partition is their image,
+// and only the tile is mapped. Serial batches walk their subtrees whole, so
+// no partitions go below them.
+void partition_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    int tile_height = min(args.tile_height, args.max_depth-args.n);
+    int tile_nodes = (1<<tile_height)-1;
+    int n = args.n;
+    LogicalRegion lr = regions[0].get_logical_region();
+    if( n == 0 )
+        store_serial_cutoff(runtime, lr.get_index_space(), args.serial_cutoff);
+    bool has_children = args.idx+tile_nodes < args.end_idx;
+    DomainPointColoring colorStartTile;
+    colorStartTile[0] = Rect<1>(args.idx, args.idx+tile_nodes-1);
+    if( has_children )
+        colorStartTile[1] = Rect<1>(args.idx+tile_nodes, args.end_idx);
+    IndexPartition ip = runtime->create_index_partition(ctx, lr.get_index_space(), Rect<1>(0, has_children ? 1 : 0), colorStartTile, DISJOINT_KIND, args.partition_color);
+    if( !has_children )
+        return;
+    LogicalPartition tile_lp = runtime->get_logical_partition(ctx, lr, ip);
+    LogicalRegion subtree = runtime->get_logical_subregion_by_color(ctx, tile_lp, 0);
+    LogicalRegion childtree = runtime->get_logical_subregion_by_color(ctx, tile_lp, 1);
+    ScratchResources scratch(ctx, runtime);
+    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
+    LogicalRegion child_ranges = create_child_ranges(scratch, tile_height);
+    args.memoize = false;
+    TaskLauncher scan_intra_launcher(NORM_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    scan_intra_launcher.tag = subtree_priority(args.max_depth, n);
+    RegionRequirement req1(subtree, READ_ONLY, EXCLUSIVE, lr);
+    RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
+    RegionRequirement req3(child_ranges, WRITE_DISCARD, EXCLUSIVE, child_ranges);
+    add_tree_fields(req1, task, 0);
+    req2.add_field(FID_X);
+    req3.add_field(FID_X);
+    scan_intra_launcher.add_region_requirement(req1);
+    scan_intra_launcher.add_region_requirement(req2);
+    scan_intra_launcher.add_region_requirement(req3);
+    execute_resident(ctx, runtime, scan_intra_launcher);
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
+    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
+    coord_t sub_tree_size = (1LL<<(args.max_depth-n-tile_height))-1;
+    coord_t start_idx = args.idx+tile_nodes;
+    vector<Arguments> child_args;
+    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
+        if(!read_acc[i].launch){
+            break;
+        }
+        coord_t idx_left_sub_tree = start_idx+2*read_acc[i].level*sub_tree_size;
+        for( int child = 0 ; child < 2 ; child++ ){
+            coord_t child_idx = idx_left_sub_tree+child*sub_tree_size;
+            Arguments tile(read_acc[i].n+1, 0, 2*read_acc[i].actual_l+child, args.max_depth, child_idx, child_idx+sub_tree_size-1, args.partition_color, args.actual_max_depth, args.tile_height);
+            tile.serial_cutoff = args.serial_cutoff;
+            child_args.push_back(tile);
+        }
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    if( child_args.size() == 0 )
+        return;
+    int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+    int points = batch_count(child_args.size(), width);
+    Rect<1> launch_domain(0, points-1);
+    IndexPartition child_ip = image_child_partition(ctx, runtime, scratch, childtree, child_ranges, points, width, args.partition_color);
+    if( width != 0 )
+        return;
+    ArgumentMap arg_map;
+    vector<vector<char> > buffers;
+    batch_argument_map(arg_map, child_args, width, buffers);
+    IndexTaskLauncher partition_launcher(PARTITION_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+    partition_launcher.tag = subtree_priority(args.max_depth, n+tile_height);
+    partition_launcher.add_region_requirement(RegionRequirement(runtime->get_logical_partition(ctx, childtree, child_ip), 0, READ_ONLY, EXCLUSIVE, lr));
+    add_tree_fields(partition_launcher.region_requirements[0], task, 0, false);
+    execute_resident(ctx, runtime, partition_launcher);
+}
+
+SubtreeRoot refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
     int tile_height = args.tile_height;
     tile_height = min(tile_height,args.max_depth-args.n);
     int tile_nodes = (1<<tile_height)-1;
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
     coord_t idx = args.idx;
     LogicalRegion lr = regions[0].get_logical_region();
     assert(lr != LogicalRegion::NO_REGION);
+    if( args.n == 0 )
+        store_serial_cutoff(runtime, lr.get_index_space(), args.serial_cutoff);
     DomainPointColoring colorStartTile;
     LogicalRegion subtree = lr;
     LogicalRegion childtree;
@@ -1296,27 +5319,36 @@ void refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regi
         LogicalPartition lp = runtime->get_logical_partition(ctx, lr, ip);
         subtree = runtime->get_logical_subregion_by_color(ctx, lp, 0);
     }
+    ScratchResources scratch(ctx, runtime);
     Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion new_helper_Region = scratch.create_region<HelperArgs>(helper_Array);
     TaskLauncher refine_intra_launcher(REFINE_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    refine_intra_launcher.tag = subtree_priority(args.max_depth, args.n);
     RegionRequirement req1(subtree, WRITE_DISCARD, EXCLUSIVE, lr);
     RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
+    add_tree_fields(req1, task, 0);
     req2.add_field(FID_X);
     refine_intra_launcher.add_region_requirement(req1);
     refine_intra_launcher.add_region_requirement(req2);
-    runtime->execute_task(ctx,refine_intra_launcher);
+    LogicalRegion source;
+    if( args.source_tile_height > 0 ){
+        source = regions[1].get_logical_region();
+        RegionRequirement req3(source, READ_ONLY, EXCLUSIVE, source);
+        add_tree_fields(req3, task, 1);
+        refine_intra_launcher.add_region_requirement(req3);
+    }
+    LogicalRegion child_ranges;
+    if( idx+tile_nodes < args.end_idx ){
+        child_ranges = create_child_ranges(scratch, tile_height);
+        RegionRequirement req4(child_ranges, WRITE_DISCARD, EXCLUSIVE, child_ranges);
+        req4.add_field(FID_X);
+        refine_intra_launcher.add_region_requirement(req4);
+    }
+    Future tile_root = execute_resident(ctx, runtime, refine_intra_launcher);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
+    PhysicalRegion physicalRegion = map_helper(ctx, runtime, new_helper_Region);
     const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    int task_counter=0;
-    vector<pair<coord_t,coord_t> >color_index;
+    vector<Arguments> child_args;
     int n = args.n;
     coord_t sub_tree_size = (1<<(args.max_depth-n-tile_height))-1;
     coord_t start_idx = args.idx+tile_nodes;
@@ -1326,40 +5358,395 @@ void refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regi
         }
         int level = read_acc[i].level;
         int nx = read_acc[i].n;
-        int actual_l = read_acc[i].actual_l;
+        coord_t actual_l = read_acc[i].actual_l;
         coord_t left_level = 2*level;
         coord_t right_level = left_level+1;
         coord_t idx_left_sub_tree = start_idx+left_level*sub_tree_size;
         coord_t idx_right_sub_tree = start_idx+right_level*sub_tree_size;
         Arguments left_args( nx+1,0 ,2*actual_l ,args.max_depth, idx_left_sub_tree , idx_right_sub_tree-1 ,args.partition_color , args.actual_max_depth , args.tile_height);
         Arguments right_args( nx+1,0, 2*actual_l+1, args.max_depth, idx_right_sub_tree , idx_right_sub_tree + sub_tree_size-1  ,args.partition_color, args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
-        color_index.push_back(make_pair(idx_left_sub_tree,idx_right_sub_tree-1));
-        color_index.push_back(make_pair(idx_right_sub_tree, idx_right_sub_tree +  sub_tree_size-1 ) );
+        left_args.serial_cutoff = args.serial_cutoff;
+        right_args.serial_cutoff = args.serial_cutoff;
+        left_args.function = right_args.function = args.function;
+        left_args.refine_tolerance = right_args.refine_tolerance = args.refine_tolerance;
+        left_args.gen = right_args.gen = args.gen;
+        left_args.pair_function = right_args.pair_function = args.pair_function;
+        left_args.pair_gen = right_args.pair_gen = args.pair_gen;
+        left_args.source_tile_height = right_args.source_tile_height = args.source_tile_height;
+        child_args.push_back(left_args);
+        child_args.push_back(right_args);
+    }
+    runtime->unmap_region(ctx, physicalRegion);
+    if( child_args.size() > 0 ){
+        int width = batch_width(args.max_depth, n+tile_height, args.serial_cutoff);
+        int task_counter = batch_count(child_args.size(), width);
+        vector<vector<char> > buffers;
+        batch_argument_map(arg_map, child_args, width, buffers);
+        IndexPartition ip = image_child_partition(ctx, runtime, scratch, childtree, child_ranges, task_counter, width, args.partition_color);
+        LogicalPartition lp = runtime->get_logical_partition(ctx, childtree, ip);
+        Rect<1> launch_domain(0,task_counter-1);
+        IndexTaskLauncher refine_launcher(width == 0 ? REFINE_INTER_TASK_ID : SERIAL_REFINE_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
+        refine_launcher.tag = subtree_priority(args.max_depth, n+tile_height);
+        refine_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
+        add_tree_fields(refine_launcher.region_requirements[0], task, 0, width != 0);
+        if( args.source_tile_height > 0 ){
+            // Each point reads the part of the source holding its subtrees:
+            // the hull of their ranges in the source layout.
+            TreeLayout source_layout(args.max_depth, args.source_tile_height);
+            int per_point = max(width, 1);
+            DomainPointColoring source_coloring;
+            for( int p = 0 ; p < task_counter ; p++ ){
+                pair<coord_t,coord_t> hull = layout_subtree_range(source_layout, child_args[p*per_point].n, child_args[p*per_point].actual_l);
+                for( int i = p*per_point+1 ; i < min((p+1)*per_point, (int)child_args.size()) ; i++ ){
+                    pair<coord_t,coord_t> range = layout_subtree_range(source_layout, child_args[i].n, child_args[i].actual_l);
+                    hull.first = min(hull.first, range.first);
+                    hull.second = max(hull.second, range.second);
+                }
+                source_coloring[p] = Rect<1>(hull.first, hull.second);
+            }
+            LogicalPartition source_lp = runtime->get_logical_partition(ctx, source, scratch.adopt(runtime->create_index_partition(ctx, source.get_index_space(), launch_domain, source_coloring, ALIASED_KIND)));
+            refine_launcher.add_region_requirement(RegionRequirement(source_lp, 0, READ_ONLY, EXCLUSIVE, source));
+            add_tree_fields(refine_launcher.region_requirements[1], task, 1, width != 0);
+        }
+        FutureMap child_roots = execute_resident(ctx, runtime, refine_launcher);
+        // A retiled tree keeps the hashes it copied from the source.
+        if( args.source_tile_height == 0 )
+            return rehash_tile(ctx, runtime, task, 0, subtree, lr, TileHashArgs(args.idx, n, args.max_depth, args.tile_height, width), point_futures(child_roots, task_counter));
+        return SubtreeRoot();
+    }
+    return tile_root.get_result<SubtreeRoot>();
+}
+
+void hash_refine_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const char *buffer = hash_task_args(task);
+    HashArgs args = *(const HashArgs *) buffer;
+    const HashFrontier *roots = (const HashFrontier *)(buffer+sizeof(HashArgs));
+    const FieldAccessor<READ_WRITE,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > table_acc(regions[0], FID_X);
+    HashLayout layout = args.layout1;
+    queue<NodeKey>tree;
+    for( int i = 0 ; i < args.count ; i++ )
+        tree.push(roots[i].key);
+    vector<HashFrontier> frontier;
+    while(!tree.empty()){
+        NodeKey key = tree.front();
+        tree.pop();
+        int n = key_level(key);
+        coord_t idx = hash_insert(table_acc, layout, key);
+        long int node_value = node_random(args.gen, 0, key);
+        node_value = node_value % 10 + 1;
+        bool is_leaf = node_value <= 3 || n == layout.max_depth - 1;
+        table_acc[idx].value = is_leaf ? node_value % 3 + 1 : 0;
+        table_acc[idx].is_leaf = is_leaf;
+        if( is_leaf )
+            continue;
+        for( int child = 0 ; child < 2 ; child++ ){
+            if( n+1 == args.stop_level )
+                frontier.push_back(HashFrontier((key<<1)|child));
+            else
+                tree.push((key<<1)|child);
+        }
+    }
+    if( regions.size() > 1 )
+        write_hash_frontier(regions[1], frontier);
+}
+
+void hash_reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const char *buffer = hash_task_args(task);
+    HashArgs args = *(const HashArgs *) buffer;
+    const HashFrontier *roots = (const HashFrontier *)(buffer+sizeof(HashArgs));
+    const FieldAccessor<READ_WRITE,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > table_acc(regions[0], FID_X);
+    HashLayout layout = args.layout1;
+    queue<HashFrontier>tree;
+    for( int i = 0 ; i < args.count ; i++ )
+        tree.push(roots[i]);
+    vector<HashFrontier> frontier;
+    while(!tree.empty()){
+        HashFrontier temp = tree.front();
+        tree.pop();
+        int n = key_level(temp.key);
+        coord_t idx = hash_find(table_acc, layout, temp.key);
+        if( idx < 0 )
+            continue;
+        if( table_acc[idx].is_leaf ){
+            table_acc[idx].value += temp.pass;
+            continue;
+        }
+        int val = (table_acc[idx].value+temp.pass)/2;
+        table_acc[idx].value = 0;
+        for( int child = 0 ; child < 2 ; child++ ){
+            if( n+1 == args.stop_level )
+                frontier.push_back(HashFrontier((temp.key<<1)|child, val));
+            else
+                tree.push(HashFrontier((temp.key<<1)|child, val));
+        }
+    }
+    if( regions.size() > 1 )
+        write_hash_frontier(regions[1], frontier);
+}
+
+void hash_gaxpy_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const char *buffer = hash_task_args(task);
+    HashArgs args = *(const HashArgs *) buffer;
+    const HashFrontier *roots = (const HashFrontier *)(buffer+sizeof(HashArgs));
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > tree1(regions[0], FID_X);
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > tree2(regions[1], FID_X);
+    const FieldAccessor<READ_WRITE,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > tree3(regions[2], FID_X);
+    queue<HashFrontier>tree;
+    for( int i = 0 ; i < args.count ; i++ )
+        tree.push(roots[i]);
+    vector<HashFrontier> frontier;
+    while(!tree.empty()){
+        HashFrontier temp = tree.front();
+        tree.pop();
+        int n = key_level(temp.key);
+        coord_t idx1 = temp.left_null ? -1 : hash_find(tree1, args.layout1, temp.key);
+        coord_t idx2 = temp.right_null ? -1 : hash_find(tree2, args.layout2, temp.key);
+        bool leaf1 = idx1 >= 0 && tree1[idx1].is_leaf;
+        bool leaf2 = idx2 >= 0 && tree2[idx2].is_leaf;
+        int value1 = idx1 >= 0 ? tree1[idx1].value : 0;
+        int value2 = idx2 >= 0 ? tree2[idx2].value : 0;
+        GaxpyStep step(temp.pass, idx1 < 0, idx2 < 0, leaf1, leaf2, value1, value2);
+        coord_t idx = hash_insert(tree3, args.layout3, temp.key);
+        tree3[idx].value = step.value;
+        tree3[idx].is_leaf = step.is_leaf;
+        if( step.is_leaf )
+            continue;
+        for( int child = 0 ; child < 2 ; child++ ){
+            HashFrontier child_args((temp.key<<1)|child, step.child_pass, step.child_left_null, step.child_right_null);
+            if( n+1 == args.stop_level )
+                frontier.push_back(child_args);
+            else
+                tree.push(child_args);
+        }
+    }
+    if( regions.size() > 3 )
+        write_hash_frontier(regions[3], frontier);
+}
+
+bool hash_level_greater( const pair<int,coord_t> &a, const pair<int,coord_t> &b ){
+    return a.first > b.first;
+}
+
+void hash_compress_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) hash_task_args(task);
+    const FieldAccessor<READ_WRITE,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > table_acc(regions[0], FID_X);
+    HashLayout layout = args.layout1;
+    coord_t base = args.table*layout.capacity;
+    vector<pair<int,coord_t> > nodes;
+    for( coord_t idx = base ; idx < base+layout.capacity ; idx++ ){
+        if( table_acc[idx].key != 0 && !table_acc[idx].is_leaf )
+            nodes.push_back(make_pair(key_level(table_acc[idx].key), idx));
     }
-    if( task_counter > 0 ){
-        IndexSpace is = childtree.get_index_space();
-        DomainPointColoring coloring;
-        for( int i = 0 ; i < task_counter ; i++ ){
-            coloring[i]= Rect<1>(color_index[i].first,color_index[i].second);
+    sort(nodes.begin(), nodes.end(), hash_level_greater);
+    for( size_t i = 0 ; i < nodes.size() ; i++ ){
+        coord_t idx = nodes[i].second;
+        int sum = 0;
+        for( int child = 0 ; child < 2 ; child++ ){
+            NodeKey child_key = (table_acc[idx].key<<1)|child;
+            if( layout.table_of(child_key) == args.table ){
+                coord_t child_idx = hash_find(table_acc, layout, child_key);
+                if( child_idx >= 0 )
+                    sum += table_acc[child_idx].value;
+            }
+            else if( regions.size() > 1 ){
+                const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > lookup_acc(regions[1], FID_X);
+                coord_t child_idx = hash_find(lookup_acc, layout, child_key);
+                if( child_idx >= 0 )
+                    sum += lookup_acc[child_idx].value;
+            }
         }
-        Rect<1>color_space = Rect<1>(0,task_counter-1);
-        IndexPartition ip = runtime->create_index_partition(ctx, is, color_space, coloring, DISJOINT_KIND, args.partition_color);
-        LogicalPartition lp = runtime->get_logical_partition(ctx, childtree, ip);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher refine_launcher(REFINE_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        refine_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        refine_launcher.add_field(0, FID_X);
-        runtime->execute_index_space(ctx, refine_launcher);
+        table_acc[idx].value = sum;
+    }
+}
+
+int hash_norm_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) hash_task_args(task);
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > table_acc(regions[0], FID_X);
+    coord_t base = args.table*args.layout1.capacity;
+    int result=0;
+    for( coord_t idx = base ; idx < base+args.layout1.capacity ; idx++ ){
+        if( table_acc[idx].key != 0 )
+            result+=table_acc[idx].value*table_acc[idx].value;
+    }
+    return result;
+}
+
+int hash_inner_product_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) hash_task_args(task);
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > tree1(regions[0], FID_X);
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > tree2(regions[1], FID_X);
+    coord_t base = args.table*args.layout1.capacity;
+    int result=0;
+    for( coord_t idx = base ; idx < base+args.layout1.capacity ; idx++ ){
+        if( tree1[idx].key == 0 )
+            continue;
+        coord_t idx2 = hash_find(tree2, args.layout2, tree1[idx].key);
+        if( idx2 >= 0 )
+            result+=tree1[idx].value*tree2[idx2].value;
+    }
+    return result;
+}
+
+void hash_print_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) hash_task_args(task);
+    const FieldAccessor<READ_ONLY,HashNode,1,coord_t,Realm::AffineAccessor<HashNode,1,coord_t> > read_acc(regions[0], FID_X);
+    int node_counter=0;
+    queue<NodeKey>tree;
+    tree.push(1);
+    while( !tree.empty() ){
+        NodeKey key = tree.front();
+        tree.pop();
+        coord_t idx = hash_find(read_acc, args.layout1, key);
+        if( idx < 0 )
+            continue;
+        int n = key_level(key);
+        node_counter++;
+        cout<<node_counter<<": "<<n<<"~"<<(key-(1ULL<<n))<<"~"<<idx<<"~"<<read_acc[idx].value<<endl;
+        if( !read_acc[idx].is_leaf ){
+            tree.push(key<<1);
+            tree.push((key<<1)|1);
+        }
+    }
+}
+
+void hash_refine_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    HashLayout layout = args.layout1;
+    LogicalRegion lr = regions[0].get_logical_region();
+    HashRegions hr = get_hash_regions(ctx, runtime, lr, layout);
+    runtime->fill_field<HashNode>(ctx, lr, lr, FID_X, HashNode());
+    vector<RegionRequirement> top_reqs(1, hash_requirement(hr.top, READ_WRITE, lr));
+    vector<HashFrontier> frontier = hash_top_pass(ctx, runtime, HASH_REFINE_INTRA_TASK_ID, args, layout, HashFrontier(1), top_reqs);
+    vector<RegionRequirement> shard_reqs(1, hash_requirement(hr.tables, READ_WRITE, lr));
+    hash_shard_launch(ctx, runtime, HASH_REFINE_INTRA_TASK_ID, args, layout, layout.shards, frontier, shard_reqs);
+}
+
+void hash_reconstruct_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    HashLayout layout = args.layout1;
+    LogicalRegion lr = regions[0].get_logical_region();
+    HashRegions hr = get_hash_regions(ctx, runtime, lr, layout);
+    vector<RegionRequirement> top_reqs(1, hash_requirement(hr.top, READ_WRITE, lr));
+    vector<HashFrontier> frontier = hash_top_pass(ctx, runtime, HASH_RECONSTRUCT_INTRA_TASK_ID, args, layout, HashFrontier(1, 0), top_reqs);
+    vector<RegionRequirement> shard_reqs(1, hash_requirement(hr.tables, READ_WRITE, lr));
+    hash_shard_launch(ctx, runtime, HASH_RECONSTRUCT_INTRA_TASK_ID, args, layout, layout.shards, frontier, shard_reqs);
+}
+
+void hash_compress_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    HashLayout layout = args.layout1;
+    LogicalRegion lr = regions[0].get_logical_region();
+    HashRegions hr = get_hash_regions(ctx, runtime, lr, layout);
+    vector<RegionRequirement> shard_reqs(1, hash_requirement(hr.tables, READ_WRITE, lr));
+    hash_shard_launch(ctx, runtime, HASH_COMPRESS_INTRA_TASK_ID, args, layout, layout.shards, vector<HashFrontier>(), shard_reqs);
+    if( layout.shard_level == 0 )
+        return;
+    HashArgs top_args = args;
+    top_args.table = layout.shards;
+    TaskLauncher top_launcher(HASH_COMPRESS_INTRA_TASK_ID, TaskArgument(&top_args, sizeof(HashArgs)));
+    top_launcher.add_region_requirement(hash_requirement(hr.top, READ_WRITE, lr));
+    top_launcher.add_region_requirement(hash_requirement(hr.shards, READ_ONLY, lr));
+    execute_resident(ctx, runtime, top_launcher);
+}
+
+int hash_norm_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    HashLayout layout = args.layout1;
+    LogicalRegion lr = regions[0].get_logical_region();
+    HashRegions hr = get_hash_regions(ctx, runtime, lr, layout);
+    vector<RegionRequirement> reqs(1, hash_requirement(hr.tables, READ_ONLY, lr));
+    FutureMap table_result = hash_shard_launch(ctx, runtime, HASH_NORM_INTRA_TASK_ID, args, layout, layout.shards+1, vector<HashFrontier>(), reqs);
+    int result=0;
+    for( int i = 0 ; i <= layout.shards ; i++ )
+        result+=table_result.get_result<int>(i);
+    return result;
+}
+
+int hash_inner_product_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    // Shard i of one tree is only ever matched against shard i of the other.
+    if( !args.layout1.aligned(args.layout2) ){
+        cerr<<"Hashed inner product needs both trees to use the same shards and shard level"<<endl;
+        abort();
+    }
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    HashRegions hr1 = get_hash_regions(ctx, runtime, lr1, args.layout1);
+    HashRegions hr2 = get_hash_regions(ctx, runtime, lr2, args.layout2);
+    vector<RegionRequirement> reqs;
+    reqs.push_back(hash_requirement(hr1.tables, READ_ONLY, lr1));
+    reqs.push_back(hash_requirement(hr2.tables, READ_ONLY, lr2));
+    FutureMap table_result = hash_shard_launch(ctx, runtime, HASH_INNER_PRODUCT_INTRA_TASK_ID, args, args.layout1, args.layout1.shards+1, vector<HashFrontier>(), reqs);
+    int result=0;
+    for( int i = 0 ; i <= args.layout1.shards ; i++ )
+        result+=table_result.get_result<int>(i);
+    return result;
+}
+
+void hash_gaxpy_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    HashArgs args = *(const HashArgs *) task->args;
+    if( !args.layout1.aligned(args.layout2) || !args.layout1.aligned(args.layout3) ){
+        cerr<<"Hashed gaxpy needs all trees to use the same shards and shard level"<<endl;
+        abort();
+    }
+    LogicalRegion lr1 = regions[0].get_logical_region();
+    LogicalRegion lr2 = regions[1].get_logical_region();
+    LogicalRegion lr3 = regions[2].get_logical_region();
+    HashRegions hr1 = get_hash_regions(ctx, runtime, lr1, args.layout1);
+    HashRegions hr2 = get_hash_regions(ctx, runtime, lr2, args.layout2);
+    HashRegions hr3 = get_hash_regions(ctx, runtime, lr3, args.layout3);
+    runtime->fill_field<HashNode>(ctx, lr3, lr3, FID_X, HashNode());
+    vector<RegionRequirement> top_reqs;
+    top_reqs.push_back(hash_requirement(hr1.top, READ_ONLY, lr1));
+    top_reqs.push_back(hash_requirement(hr2.top, READ_ONLY, lr2));
+    top_reqs.push_back(hash_requirement(hr3.top, READ_WRITE, lr3));
+    vector<HashFrontier> frontier = hash_top_pass(ctx, runtime, HASH_GAXPY_INTRA_TASK_ID, args, args.layout3, HashFrontier(1), top_reqs);
+    vector<RegionRequirement> shard_reqs;
+    shard_reqs.push_back(hash_requirement(hr1.tables, READ_ONLY, lr1));
+    shard_reqs.push_back(hash_requirement(hr2.tables, READ_ONLY, lr2));
+    shard_reqs.push_back(hash_requirement(hr3.tables, READ_WRITE, lr3));
+    hash_shard_launch(ctx, runtime, HASH_GAXPY_INTRA_TASK_ID, args, args.layout3, args.layout3.shards, frontier, shard_reqs);
+}
+
+// The default mapper with subtree_priority honoured: ready tasks are picked
+// highest priority first, and it becomes the task's priority on its processor
+// so a deep subtree's task also overtakes shallow work already queued there.
+// A point of a POINT_PRIORITY_TAG launch goes by its own priority. The flag
+// bits of the tag are left to DefaultMapper.
+class SubtreeMapper : public DefaultMapper {
+public:
+    SubtreeMapper( MapperRuntime *rt, Machine machine, Processor local ) : DefaultMapper(rt, machine, local, "subtree_mapper") {}
+    virtual void select_tasks_to_map( const MapperContext ctx, const SelectMappingInput &input, SelectMappingOutput &output );
+    virtual void map_task( const MapperContext ctx, const Task &task, const MapTaskInput &input, MapTaskOutput &output );
+};
+
+bool deeper_first( const Task *a, const Task *b ){
+    return task_priority(*a) > task_priority(*b);
+}
+
+void SubtreeMapper::select_tasks_to_map( const MapperContext ctx, const SelectMappingInput &input, SelectMappingOutput &output ){
+    if( input.ready_tasks.empty() ){
+        DefaultMapper::select_tasks_to_map(ctx, input, output);
+        return;
     }
+    vector<const Task*> ready(input.ready_tasks.begin(), input.ready_tasks.end());
+    stable_sort(ready.begin(), ready.end(), deeper_first);
+    for( size_t i = 0 ; i < ready.size() && i < max_schedule_count ; i++ )
+        output.map_tasks.insert(ready[i]);
+}
+
+void SubtreeMapper::map_task( const MapperContext ctx, const Task &task, const MapTaskInput &input, MapTaskOutput &output ){
+    DefaultMapper::map_task(ctx, task, input, output);
+    output.task_priority = task_priority(task);
+}
+
+void register_subtree_mapper( Machine machine, HighLevelRuntime *runtime, const std::set<Processor> &local_procs ){
+    for( std::set<Processor>::const_iterator it = local_procs.begin() ; it != local_procs.end() ; ++it )
+        runtime->replace_default_mapper(new SubtreeMapper(runtime->get_mapper_runtime(), machine, *it), *it);
 }
 
 int main(int argc, char** argv){
 
-    srand(time(NULL));
     Runtime::set_top_level_task_id(TOP_LEVEL_TASK_ID);
 
     {
@@ -1371,14 +5758,14 @@ int main(int argc, char** argv){
     {
         TaskVariantRegistrar registrar(REFINE_INTER_TASK_ID, "refine_inter");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<refine_inter_task>(registrar, "refine_inter");
+        Runtime::preregister_task_variant<SubtreeRoot,refine_inter_task>(registrar, "refine_inter");
     }
 
     {
         TaskVariantRegistrar registrar(REFINE_INTRA_TASK_ID, "refine_intra");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
         registrar.set_leaf(true);
-        Runtime::preregister_task_variant<refine_intra_task>(registrar, "refine_intra");
+        Runtime::preregister_task_variant<SubtreeRoot,refine_intra_task>(registrar, "refine_intra");
     }
 
     {
@@ -1390,7 +5777,7 @@ int main(int argc, char** argv){
     {
         TaskVariantRegistrar registrar(COMPRESS_INTER_TASK_ID, "compress_inter");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<compress_inter_task>(registrar, "compress_inter");
+        Runtime::preregister_task_variant<RootPosArgs,compress_inter_task>(registrar, "compress_inter");
     }
 
     {
@@ -1404,21 +5791,21 @@ int main(int argc, char** argv){
         TaskVariantRegistrar registrar(COMPRESS_UPDATE_TASK_ID, "compress_update");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
         registrar.set_leaf(true);
-        Runtime::preregister_task_variant<compress_update_task>(registrar, "compress_update");
+        Runtime::preregister_task_variant<RootPosArgs,compress_update_task>(registrar, "compress_update");
 
     }
 
     {
         TaskVariantRegistrar registrar(RECONSTRUCT_INTER_TASK_ID, "reconstruct_inter");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<reconstruct_inter_task>(registrar, "reconstruct_inter");
+        Runtime::preregister_task_variant<SubtreeRoot,reconstruct_inter_task>(registrar, "reconstruct_inter");
     }
 
     {
         TaskVariantRegistrar registrar(RECONSTRUCT_INTRA_TASK_ID, "reconstruct_intra");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
         registrar.set_leaf(true);
-        Runtime::preregister_task_variant<reconstruct_intra_task>(registrar, "reconstruct_intra");
+        Runtime::preregister_task_variant<SubtreeRoot,reconstruct_intra_task>(registrar, "reconstruct_intra");
     }
 
     {
@@ -1431,7 +5818,7 @@ int main(int argc, char** argv){
         TaskVariantRegistrar registrar(NORM_INTRA_TASK_ID, "norm_intra");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
         registrar.set_leaf(true);
-        Runtime::preregister_task_variant<int,norm_intra_task>(registrar, "norm_intra");
+        Runtime::preregister_task_variant<TileProduct,norm_intra_task>(registrar, "norm_intra");
     }
 
     {
@@ -1444,7 +5831,7 @@ int main(int argc, char** argv){
         TaskVariantRegistrar registrar(INNER_PRODUCT_INTRA_TASK_ID, "inner_product_intra");
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
         registrar.set_leaf(true);
-        Runtime::preregister_task_variant<int,inner_product_intra_task>(registrar, "inner_product_intra");
+        Runtime::preregister_task_variant<TileProduct,inner_product_intra_task>(registrar, "inner_product_intra");
     }
 
     {
@@ -1460,5 +5847,280 @@ int main(int argc, char** argv){
         Runtime::preregister_task_variant<gaxpy_intra_task>(registrar, "gaxpy_intra");
     }
 
+    {
+        TaskVariantRegistrar registrar(TRUNCATE_INTER_TASK_ID, "truncate_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<TruncateResult,truncate_inter_task>(registrar, "truncate_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(TRUNCATE_UPDATE_TASK_ID, "truncate_update");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<TruncateResult,truncate_update_task>(registrar, "truncate_update");
+    }
+
+    {
+        TaskVariantRegistrar registrar(INNER_PRODUCT_MIXED_INTER_TASK_ID, "inner_product_mixed_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<int,inner_product_mixed_inter_task>(registrar, "inner_product_mixed_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(INNER_PRODUCT_MIXED_INTRA_TASK_ID, "inner_product_mixed_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,inner_product_mixed_intra_task>(registrar, "inner_product_mixed_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(GAXPY_MIXED_INTER_TASK_ID, "gaxpy_mixed_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<SubtreeRoot,gaxpy_mixed_inter_task>(registrar, "gaxpy_mixed_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(GAXPY_MIXED_INTRA_TASK_ID, "gaxpy_mixed_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<SubtreeRoot,gaxpy_mixed_intra_task>(registrar, "gaxpy_mixed_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_REFINE_TASK_ID, "hash_refine");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<hash_refine_task>(registrar, "hash_refine");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_REFINE_INTRA_TASK_ID, "hash_refine_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<hash_refine_intra_task>(registrar, "hash_refine_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_COMPRESS_TASK_ID, "hash_compress");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<hash_compress_task>(registrar, "hash_compress");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_COMPRESS_INTRA_TASK_ID, "hash_compress_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<hash_compress_intra_task>(registrar, "hash_compress_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_RECONSTRUCT_TASK_ID, "hash_reconstruct");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<hash_reconstruct_task>(registrar, "hash_reconstruct");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_RECONSTRUCT_INTRA_TASK_ID, "hash_reconstruct_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<hash_reconstruct_intra_task>(registrar, "hash_reconstruct_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_NORM_TASK_ID, "hash_norm");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<int,hash_norm_task>(registrar, "hash_norm");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_NORM_INTRA_TASK_ID, "hash_norm_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,hash_norm_intra_task>(registrar, "hash_norm_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_INNER_PRODUCT_TASK_ID, "hash_inner_product");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<int,hash_inner_product_task>(registrar, "hash_inner_product");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_INNER_PRODUCT_INTRA_TASK_ID, "hash_inner_product_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,hash_inner_product_intra_task>(registrar, "hash_inner_product_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_GAXPY_TASK_ID, "hash_gaxpy");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<hash_gaxpy_task>(registrar, "hash_gaxpy");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_GAXPY_INTRA_TASK_ID, "hash_gaxpy_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<hash_gaxpy_intra_task>(registrar, "hash_gaxpy_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_PRINT_TASK_ID, "hash_print");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<hash_print_task>(registrar, "hash_print");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_REFINE_TASK_ID, "serial_refine");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<SubtreeRootBatch,serial_refine_task>(registrar, "serial_refine");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_COMPRESS_TASK_ID, "serial_compress");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<CompressBatchResult,serial_compress_task>(registrar, "serial_compress");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_RECONSTRUCT_TASK_ID, "serial_reconstruct");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<SubtreeRootBatch,serial_reconstruct_task>(registrar, "serial_reconstruct");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_NORM_TASK_ID, "serial_norm");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,serial_norm_task>(registrar, "serial_norm");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_TRUNCATE_TASK_ID, "serial_truncate");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<TruncateBatchResult,serial_truncate_task>(registrar, "serial_truncate");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_INNER_PRODUCT_TASK_ID, "serial_inner_product");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,serial_inner_product_task>(registrar, "serial_inner_product");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_GAXPY_TASK_ID, "serial_gaxpy");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<serial_gaxpy_task>(registrar, "serial_gaxpy");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_INNER_PRODUCT_MIXED_TASK_ID, "serial_inner_product_mixed");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<int,serial_inner_product_mixed_task>(registrar, "serial_inner_product_mixed");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERIAL_GAXPY_MIXED_TASK_ID, "serial_gaxpy_mixed");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<SubtreeRootBatch,serial_gaxpy_mixed_task>(registrar, "serial_gaxpy_mixed");
+    }
+
+    {
+        TaskVariantRegistrar registrar(DIFFERENTIATE_INTER_TASK_ID, "differentiate_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<differentiate_inter_task>(registrar, "differentiate_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(DIFFERENTIATE_INTRA_TASK_ID, "differentiate_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<differentiate_intra_task>(registrar, "differentiate_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(APPLY_INTER_TASK_ID, "apply_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<apply_inter_task>(registrar, "apply_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(APPLY_INTRA_TASK_ID, "apply_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<apply_intra_task>(registrar, "apply_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(INNER_PRODUCT_SCREENED_INTER_TASK_ID, "inner_product_screened_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<InnerProductEstimate,inner_product_screened_inter_task>(registrar, "inner_product_screened_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(INNER_PRODUCT_SCREENED_INTRA_TASK_ID, "inner_product_screened_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<InnerProductEstimate,inner_product_screened_intra_task>(registrar, "inner_product_screened_intra");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SERVICE_WAKE_TASK_ID, "service_wake");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<service_wake_task>(registrar, "service_wake");
+    }
+
+    {
+        TaskVariantRegistrar registrar(PREFETCH_TILE_TASK_ID, "prefetch_tile");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<prefetch_tile_task>(registrar, "prefetch_tile");
+    }
+
+    {
+        TaskVariantRegistrar registrar(PARTITION_INTER_TASK_ID, "partition_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<partition_inter_task>(registrar, "partition_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(HASH_TILE_TASK_ID, "hash_tile");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<SubtreeRoot,hash_tile_task>(registrar, "hash_tile");
+    }
+
+    {
+        TaskVariantRegistrar registrar(SAME_TREE_TASK_ID, "same_tree");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<int,same_tree_task>(registrar, "same_tree");
+    }
+
+    {
+        TaskVariantRegistrar registrar(ACCUMULATE_INTER_TASK_ID, "accumulate_inter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<accumulate_inter_task>(registrar, "accumulate_inter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(ACCUMULATE_INTRA_TASK_ID, "accumulate_intra");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<accumulate_intra_task>(registrar, "accumulate_intra");
+    }
+
+    Runtime::register_reduction_op<TreeSumReduction>(TREE_SUM_REDOP_ID);
+
+    Runtime::add_registration_callback(register_subtree_mapper);
     return Runtime::start(argc,argv);
 }
\ No newline at end of file